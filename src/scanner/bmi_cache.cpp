@@ -0,0 +1,290 @@
+#include "bmi_cache.h"
+
+#include "parallel.h"
+#include "trace.h"
+#include "file_time.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <unordered_map>
+
+#pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
+#include <fmt/format.h>
+
+namespace fs = std::filesystem;
+
+namespace cppm {
+
+void ContentDigest::add_bytes(std::string_view data) {
+	uint64_t a = this->a, b = this->b;
+	for (unsigned char c : data) {
+		a = (a ^ c) * 0x100000001b3;
+		b = (b ^ c) * 0x9e3779b97f4a7c15; // a different odd multiplier, so the lanes don't collide together
+	}
+	this->a = a;
+	this->b = b;
+}
+
+void ContentDigest::add(std::string_view str) {
+	uint64_t size = str.size();
+	add_bytes({ (const char*)&size, sizeof(size) });
+	add_bytes(str);
+}
+
+bool ContentDigest::add_file(const std::string& path) {
+	std::ifstream fin(path, std::ios::binary);
+	if (!fin)
+		return false;
+	char buf[64 * 1024];
+	uint64_t size = 0;
+	while (fin) {
+		fin.read(buf, sizeof(buf));
+		add_bytes({ buf, (std::size_t)fin.gcount() });
+		size += (uint64_t)fin.gcount();
+	}
+	if (fin.bad())
+		return false;
+	add_bytes({ (const char*)&size, sizeof(size) });
+	return true;
+}
+
+std::string ContentDigest::to_string() const {
+	return fmt::format("{:016x}{:016x}", a, b);
+}
+
+std::string normalize_command(std::string_view cmd) {
+	std::string ret;
+	ret.reserve(cmd.size());
+	bool in_quotes = false, pending_space = false;
+	for (char c : cmd) {
+		bool is_space = (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+		if (is_space && !in_quotes) {
+			pending_space = !ret.empty();
+			continue;
+		}
+		if (pending_space) {
+			ret += ' ';
+			pending_space = false;
+		}
+		if (c == '"')
+			in_quotes = !in_quotes;
+		ret += c;
+	}
+	return ret;
+}
+
+// the first argument of the command, including the quotes if it's quoted
+static std::string_view get_compiler_arg(std::string_view cmd) {
+	if (!cmd.empty() && cmd[0] == '"')
+		return cmd.substr(0, cmd.find('"', 1) + 1);
+	return cmd.substr(0, cmd.find(' '));
+}
+
+std::string get_compiler_identity(std::string_view cmd) {
+	std::string_view compiler = get_compiler_arg(cmd);
+	if (compiler.size() >= 2 && compiler.front() == '"' && compiler.back() == '"')
+		compiler = compiler.substr(1, compiler.size() - 2);
+	fs::path path = fs::u8path(compiler);
+	std::error_code ec;
+	if (!path.has_parent_path()) {
+		// e.g "cl.exe", which is run from the PATH
+#ifdef _WIN32
+		constexpr char path_separator = ';';
+		if (!path.has_extension())
+			path += ".exe";
+#else
+		constexpr char path_separator = ':';
+#endif
+		const char* env_path = std::getenv("PATH");
+		std::string_view dirs = env_path ? env_path : "";
+		while (!dirs.empty()) {
+			std::string_view dir = dirs.substr(0, dirs.find(path_separator));
+			dirs.remove_prefix(std::min(dirs.size(), dir.size() + 1));
+			if (dir.empty())
+				continue;
+			fs::path candidate = fs::u8path(dir) / path;
+			if (fs::is_regular_file(candidate, ec)) {
+				path = std::move(candidate);
+				break;
+			}
+		}
+	}
+	fs::path resolved = fs::canonical(path, ec);
+	if (ec)
+		return "";
+	auto size = fs::file_size(resolved, ec);
+	if (ec)
+		return "";
+	return fmt::format("{} {} {}", resolved.string(), size, get_last_write_time(resolved));
+}
+
+vector_map<scan_item_idx_t, std::string> compute_bmi_cache_keys(const CollatedModuleInfo& info,
+	const vector_map<scan_item_idx_t, std::string>& commands,
+	const vector_map<scan_item_idx_t, std::vector<std::string>>& file_deps, FileDigestStore* digest_store)
+{
+	TRACE();
+	// most of the headers are included by many items, so each file is only read once
+	std::vector<std::string_view> files;
+	std::unordered_map<std::string_view, std::size_t> file_to_idx;
+	for (auto idx : commands.indices())
+		if (!commands[idx].empty())
+			for (auto& file : file_deps[idx])
+				if (file_to_idx.try_emplace(file, files.size()).second)
+					files.push_back(file);
+
+	// and only if it was written since its digest was stored
+	std::vector<FileDigest> stored_digests;
+	if (digest_store)
+		stored_digests = digest_store->get(files);
+	std::vector<FileDigest> new_digests(files.size()); // the invalid ones are still up to date
+	std::vector<std::optional<std::string>> file_digests(files.size());
+	std::atomic<std::size_t> nr_digested = 0;
+	parallel_for(std::size_t { 0 }, files.size(), [&](std::size_t i) {
+		file_time_t lwt = get_last_write_time(fs::u8path(files[i]));
+		if (lwt == std::numeric_limits<file_time_t>::max()) // e.g it doesn't exist
+			return;
+		if (digest_store && stored_digests[i].is_valid() && stored_digests[i].last_write_time == lwt) {
+			file_digests[i] = ContentDigest { stored_digests[i].a, stored_digests[i].b }.to_string();
+			return;
+		}
+		ContentDigest digest;
+		if (!digest.add_file((std::string)files[i]))
+			return;
+		file_digests[i] = digest.to_string();
+		new_digests[i] = { lwt, digest.a, digest.b };
+		nr_digested++;
+	}, 16);
+	TRACE_COUNTER("BMI cache files digested", nr_digested.load());
+	if (digest_store && nr_digested > 0)
+		digest_store->put(files, new_digests);
+
+	// most of the items share a few compilers
+	std::unordered_map<std::string_view, std::string> compiler_identities;
+	for (auto& cmd : commands)
+		if (!cmd.empty())
+			compiler_identities.try_emplace(get_compiler_arg(cmd));
+	for (auto& [compiler, identity] : compiler_identities)
+		identity = get_compiler_identity(compiler);
+
+	vector_map<scan_item_idx_t, std::string> keys;
+	keys.resize(commands.size());
+	auto compute_key = [&](scan_item_idx_t idx) -> std::string {
+		auto& compiler_identity = compiler_identities[get_compiler_arg(commands[idx])];
+		if (compiler_identity.empty())
+			return "";
+		ContentDigest digest;
+		digest.add(commands[idx]);
+		digest.add(compiler_identity);
+		for (auto& file : file_deps[idx]) {
+			auto& file_digest = file_digests[file_to_idx[file]];
+			if (!file_digest)
+				return "";
+			digest.add(file);
+			digest.add(*file_digest);
+		}
+		for (auto imp_idx : info.imports_item[idx]) {
+			if (keys[imp_idx].empty())
+				return "";
+			digest.add(keys[imp_idx]);
+		}
+		return digest.to_string();
+	};
+
+	// the imports need their keys before their importers, an item that's still being visited
+	// when it's imported again is in a cycle, and then it doesn't get a key
+	enum class visit : char { not_visited, visiting, done };
+	vector_map<scan_item_idx_t, visit> visited;
+	visited.resize(commands.size());
+	std::vector<scan_item_idx_t> stack;
+	for (auto root_idx : commands.indices()) {
+		if (commands[root_idx].empty() || visited[root_idx] != visit::not_visited)
+			continue;
+		stack.push_back(root_idx);
+		while (!stack.empty()) {
+			auto idx = stack.back();
+			if (visited[idx] == visit::not_visited) {
+				visited[idx] = visit::visiting;
+				for (auto imp_idx : info.imports_item[idx])
+					if (visited[imp_idx] == visit::not_visited)
+						stack.push_back(imp_idx);
+				continue;
+			}
+			stack.pop_back();
+			if (visited[idx] == visit::visiting) {
+				if (!commands[idx].empty())
+					keys[idx] = compute_key(idx);
+				visited[idx] = visit::done;
+			}
+		}
+	}
+	return keys;
+}
+
+std::string BmiCacheKeyFile::to_string() const {
+	std::string ret = key + "\n";
+	for (auto& output : outputs)
+		ret += output + "\n";
+	return ret;
+}
+
+BmiCacheKeyFile BmiCacheKeyFile::read(const std::string& path) {
+	std::ifstream fin(path);
+	if (!fin)
+		throw std::invalid_argument(fmt::format("{} does not exist", path));
+	BmiCacheKeyFile ret;
+	std::getline(fin, ret.key);
+	std::string line;
+	while (std::getline(fin, line))
+		if (!line.empty())
+			ret.outputs.push_back(line);
+	return ret;
+}
+
+std::string BmiCache::entry_file(std::string_view key, std::size_t output_idx) const {
+	return (fs::path { dir } / key.substr(0, 2) / fmt::format("{}.{}", key, output_idx)).string();
+}
+
+bool BmiCache::restore(std::string_view key, const std::vector<std::string>& outputs) const {
+	if (key.empty() || outputs.empty())
+		return false;
+	std::error_code ec;
+	for (std::size_t i = 0; i < outputs.size(); ++i)
+		if (!fs::exists(entry_file(key, i), ec))
+			return false;
+	for (std::size_t i = 0; i < outputs.size(); ++i) {
+		fs::path output { outputs[i] };
+		if (output.has_parent_path())
+			fs::create_directories(output.parent_path(), ec);
+		if (!fs::copy_file(entry_file(key, i), output, fs::copy_options::overwrite_existing, ec))
+			return false;
+		// the copy may keep the time of the cached file, but the output has to be newer than the inputs for ninja
+		fs::last_write_time(output, fs::file_time_type::clock::now(), ec);
+	}
+	return true;
+}
+
+void BmiCache::store(std::string_view key, const std::vector<std::string>& outputs) const {
+	if (key.empty())
+		return;
+	fs::create_directories(fs::path { entry_file(key, 0) }.parent_path());
+	std::random_device rd;
+	for (std::size_t i = 0; i < outputs.size(); ++i) {
+		std::string entry = entry_file(key, i);
+		std::string tmp_entry = fmt::format("{}.{:08x}.tmp", entry, rd());
+		fs::copy_file(outputs[i], tmp_entry, fs::copy_options::overwrite_existing);
+		std::error_code ec;
+		fs::rename(tmp_entry, entry, ec);
+		if (ec) {
+			fs::remove(tmp_entry, ec);
+			throw std::runtime_error(fmt::format("failed to store '{}' in the BMI cache", outputs[i]));
+		}
+	}
+}
+
+} // namespace cppm
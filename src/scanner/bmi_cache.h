@@ -0,0 +1,82 @@
+#pragma once
+
+#include "scanner.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cppm {
+
+// a 128 bit digest (two FNV-1a style lanes with different multipliers), which is stable across platforms and builds of the tool unlike std::hash
+// note: this isn't cryptographic, it's only meant for a local cache
+struct ContentDigest
+{
+	uint64_t a = 0xcbf29ce484222325, b = 0x6c62272e07bb0142;
+
+	void add_bytes(std::string_view data);
+	// the strings are length prefixed so that e.g "ab","c" and "a","bc" are different
+	void add(std::string_view str);
+	// returns false if the file couldn't be read
+	bool add_file(const std::string& path);
+	std::string to_string() const;
+};
+
+// collapses the whitespace (outside of quotes) so that the same flags formatted differently get the same key
+// note: the paths are kept because the compilers record them in the BMIs, so different build dirs
+// can only share the cache entries if they use the same paths (e.g relative ones)
+std::string normalize_command(std::string_view cmd);
+
+// the resolved path, the size and the write time of the compiler (the first argument of the command),
+// so that e.g a compiler updated in place changes the keys, since the BMIs usually can't be read by the other versions
+// returns "" if the compiler can't be found (e.g in the PATH)
+std::string get_compiler_identity(std::string_view cmd);
+
+// where compute_bmi_cache_keys keeps the digests of the files between the scans, with the write times they were read at,
+// so that only the files that were written since have to be read again (see Scanner::get_file_digests)
+struct FileDigestStore
+{
+	// the files that aren't in the store get an invalid digest
+	virtual std::vector<FileDigest> get(tcb::span<const std::string_view> files) = 0;
+	virtual void put(tcb::span<const std::string_view> files, tcb::span<const FileDigest> digests) = 0;
+	virtual ~FileDigestStore() = default;
+};
+
+// the key of each item that has a command (i.e the ones that produce a BMI) is a digest of:
+// the normalized command (including the module flags), the identity of its compiler, the paths and the contents of the files it depends on
+// (including its source) and the keys of the items that it imports, so any change in an imported BMI's inputs changes the key too
+// the key is "" if the item can't be cached, e.g if one of its files or its compiler couldn't be read or it's in an import cycle
+vector_map<scan_item_idx_t, std::string> compute_bmi_cache_keys(const CollatedModuleInfo& info,
+	const vector_map<scan_item_idx_t, std::string>& commands,
+	const vector_map<scan_item_idx_t, std::vector<std::string>>& file_deps, FileDigestStore* digest_store = nullptr);
+
+// written by the generators next to each item's output, this tells the cache_compile wrapper what to cache
+// the format is the key on the first line and then the outputs one per line, and an empty key means don't cache
+struct BmiCacheKeyFile
+{
+	std::string key;
+	std::vector<std::string> outputs;
+
+	std::string to_string() const;
+	// throws if the file doesn't exist
+	static BmiCacheKeyFile read(const std::string& path);
+};
+
+// the outputs of each compile are stored under the key as {dir}/{first 2 chars of the key}/{key}.{output idx}
+struct BmiCache
+{
+	std::string dir;
+
+	std::string entry_file(std::string_view key, std::size_t output_idx) const;
+
+	// copies the outputs out of the cache if it has all of them, returns false otherwise
+	bool restore(std::string_view key, const std::vector<std::string>& outputs) const;
+
+	// copies the outputs into the cache, throws if one of them can't be copied
+	// note: each file is copied to a temporary name first and then renamed
+	// so that concurrent builds never restore a partially written file
+	void store(std::string_view key, const std::vector<std::string>& outputs) const;
+};
+
+} // namespace cppm
@@ -0,0 +1,109 @@
+#include "critical_path.h"
+
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+
+namespace cppm {
+
+CriticalPathInfo compute_critical_paths(const CollatedModuleInfo& info,
+	span_map<scan_item_idx_t, const uint64_t> costs)
+{
+	TRACE();
+	std::size_t nr_items = (std::size_t)info.imports_item.size();
+	auto cost = [&](scan_item_idx_t idx) -> uint64_t {
+		return costs.empty() ? 1 : costs[idx];
+	};
+
+	// the reverse of imports_item, i.e the items that directly import each item
+	std::vector<std::size_t> importers_begin(nr_items + 1, 0);
+	for (auto idx : info.imports_item.indices())
+		for (auto imp_idx : info.imports_item[idx])
+			importers_begin[(std::size_t)imp_idx + 1]++;
+	for (std::size_t i = 0; i < nr_items; ++i)
+		importers_begin[i + 1] += importers_begin[i];
+	std::vector<scan_item_idx_t> importers(importers_begin[nr_items]);
+	{
+		auto insert_pos = importers_begin;
+		for (auto idx : info.imports_item.indices())
+			for (auto imp_idx : info.imports_item[idx])
+				importers[insert_pos[(std::size_t)imp_idx]++] = idx;
+	}
+	auto nr_importers = [&](scan_item_idx_t idx) {
+		return importers_begin[(std::size_t)idx + 1] - importers_begin[(std::size_t)idx];
+	};
+
+	CriticalPathInfo ret;
+	ret.longest_chain.resize(info.imports_item.size());
+	ret.downstream_weight.resize(info.imports_item.size());
+
+	// visit the items after all of their importers, starting from the ones that nothing imports
+	std::vector<std::size_t> nr_unvisited_importers(nr_items);
+	std::vector<uint64_t> longest_importer_chain(nr_items, 0);
+	std::vector<scan_item_idx_t> ready;
+	for (auto idx : info.imports_item.indices()) {
+		nr_unvisited_importers[(std::size_t)idx] = nr_importers(idx);
+		if (nr_importers(idx) == 0)
+			ready.push_back(idx);
+	}
+	while (!ready.empty()) {
+		auto idx = ready.back();
+		ready.pop_back();
+		uint64_t chain = cost(idx) + longest_importer_chain[(std::size_t)idx];
+		ret.longest_chain[idx] = chain;
+		for (auto imp_idx : info.imports_item[idx]) {
+			auto& longest = longest_importer_chain[(std::size_t)imp_idx];
+			longest = std::max(longest, chain);
+			if (--nr_unvisited_importers[(std::size_t)imp_idx] == 0)
+				ready.push_back(imp_idx);
+		}
+	}
+	// only the items in or behind an import cycle are left
+	for (auto idx : info.imports_item.indices())
+		if (nr_unvisited_importers[(std::size_t)idx] != 0)
+			ret.longest_chain[idx] = cost(idx) + longest_importer_chain[(std::size_t)idx];
+
+	// the importers can be shared between multiple paths so this needs a separate visit for each imported item
+	std::vector<scan_item_idx_t> imported_items;
+	for (auto idx : info.imports_item.indices()) {
+		if (nr_importers(idx) == 0)
+			ret.downstream_weight[idx] = cost(idx);
+		else
+			imported_items.push_back(idx);
+	}
+	constexpr std::size_t min_items_per_chunk = 16;
+	std::size_t nr_chunks = std::min(default_nr_threads(), (imported_items.size() + min_items_per_chunk - 1) / min_items_per_chunk);
+	nr_chunks = std::max(nr_chunks, std::size_t { 1 });
+	std::size_t chunk_size = (imported_items.size() + nr_chunks - 1) / nr_chunks;
+	parallel_for(std::size_t { 0 }, nr_chunks, [&](std::size_t chunk_idx) {
+		std::vector<scan_item_idx_t> queue;
+		std::vector<bool> is_in_queue(nr_items);
+		std::size_t chunk_end = std::min(imported_items.size(), (chunk_idx + 1) * chunk_size);
+		for (std::size_t k = chunk_idx * chunk_size; k < chunk_end; ++k) {
+			auto root_idx = imported_items[k];
+			queue.clear();
+			queue.push_back(root_idx);
+			is_in_queue[(std::size_t)root_idx] = true;
+			uint64_t weight = 0;
+			for (std::size_t s = 0; s < queue.size(); ++s) {
+				auto idx = queue[s];
+				weight += cost(idx);
+				for (std::size_t i = importers_begin[(std::size_t)idx]; i < importers_begin[(std::size_t)idx + 1]; ++i) {
+					auto importer_idx = importers[i];
+					if (!is_in_queue[(std::size_t)importer_idx]) {
+						is_in_queue[(std::size_t)importer_idx] = true;
+						queue.push_back(importer_idx);
+					}
+				}
+			}
+			ret.downstream_weight[root_idx] = weight;
+			for (auto idx : queue)
+				is_in_queue[(std::size_t)idx] = false;
+		}
+	}, 1);
+
+	return ret;
+}
+
+} // namespace cppm
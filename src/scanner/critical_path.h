@@ -0,0 +1,24 @@
+#pragma once
+
+#include "scanner.h"
+
+#include <cstdint>
+
+namespace cppm {
+
+// scheduling hints for the items based on the module dependency graph,
+// the items that have a lot of (transitive) importers should be built first
+struct CriticalPathInfo
+{
+	// the sum of the costs of the item and all of the items that transitively import it
+	vector_map<scan_item_idx_t, uint64_t> downstream_weight;
+	// the cost of the most expensive chain of importers that starts at (and includes) the item
+	vector_map<scan_item_idx_t, uint64_t> longest_chain;
+};
+
+// costs can be e.g the compile times from the last build, or empty if each item should cost 1
+// note: the items in an import cycle (if any) don't get the costs of the chains through the cycle
+CriticalPathInfo compute_critical_paths(const CollatedModuleInfo& info,
+	span_map<scan_item_idx_t, const uint64_t> costs = span_map<scan_item_idx_t, const uint64_t> {});
+
+} // namespace cppm
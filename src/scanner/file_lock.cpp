@@ -0,0 +1,107 @@
+#include "file_lock.h"
+
+#include <filesystem>
+#include <stdexcept>
+
+#pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
+#include <fmt/format.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace cppm {
+
+file_lock::~file_lock() {
+	close();
+}
+
+bool file_lock::is_open() const {
+	return handle != -1;
+}
+
+#ifdef _WIN32
+
+void file_lock::open(const std::string& path) {
+	close();
+	this->path = path;
+	// the file can be removed while it's open, e.g by clean_all
+	HANDLE h = CreateFileW(std::filesystem::u8path(path).wstring().c_str(), GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+		throw std::runtime_error(fmt::format("failed to open the lock file '{}'", path));
+	handle = (std::intptr_t)h;
+}
+
+void file_lock::close() {
+	if (handle != -1)
+		CloseHandle((HANDLE)handle); // this also releases the lock
+	handle = -1;
+}
+
+static void lock_file(std::intptr_t handle, DWORD flags, const std::string& path) {
+	OVERLAPPED ov = {};
+	if (!LockFileEx((HANDLE)handle, flags, 0, MAXDWORD, MAXDWORD, &ov))
+		throw std::runtime_error(fmt::format("failed to lock '{}'", path));
+}
+
+void file_lock::lock_shared() {
+	lock_file(handle, 0, path);
+}
+
+void file_lock::lock_exclusive() {
+	lock_file(handle, LOCKFILE_EXCLUSIVE_LOCK, path);
+}
+
+void file_lock::unlock() {
+	OVERLAPPED ov = {};
+	UnlockFileEx((HANDLE)handle, 0, MAXDWORD, MAXDWORD, &ov);
+}
+
+#else
+
+void file_lock::open(const std::string& path) {
+	close();
+	this->path = path;
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1)
+		throw std::runtime_error(fmt::format("failed to open the lock file '{}'", path));
+	handle = fd;
+}
+
+void file_lock::close() {
+	if (handle != -1)
+		::close((int)handle); // this also releases the lock
+	handle = -1;
+}
+
+static void lock_file(std::intptr_t handle, int op, const std::string& path) {
+	int ret;
+	do {
+		ret = flock((int)handle, op);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+		throw std::runtime_error(fmt::format("failed to lock '{}'", path));
+}
+
+void file_lock::lock_shared() {
+	lock_file(handle, LOCK_SH, path);
+}
+
+void file_lock::lock_exclusive() {
+	lock_file(handle, LOCK_EX, path);
+}
+
+void file_lock::unlock() {
+	flock((int)handle, LOCK_UN);
+}
+
+#endif
+
+} // namespace cppm
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cppm {
+
+// an advisory lock on a whole file that can be shared between processes or held exclusively by one of them
+// note: this uses flock on posix, so the locks are per open file, i.e two file_locks on the same file
+// in the same process exclude each other just like they would in different processes
+struct file_lock {
+	file_lock() = default;
+	file_lock(const file_lock&) = delete;
+	file_lock& operator=(const file_lock&) = delete;
+	~file_lock();
+
+	// creates the file if it doesn't exist
+	void open(const std::string& path);
+	void close();
+	bool is_open() const;
+
+	// these block until the lock is acquired
+	void lock_shared();
+	void lock_exclusive();
+	void unlock();
+
+private:
+	std::intptr_t handle = -1;
+	std::string path;
+};
+
+} // namespace cppm
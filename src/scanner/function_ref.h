@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace cppm {
+
+// a non-owning reference to a callable, which unlike std::function never allocates
+// note: the callable must outlive the function_ref, so this should only be used for parameters
+template<typename Fn> class function_ref;
+
+template<typename R, typename... Args>
+class function_ref<R(Args...)>
+{
+	void* obj = nullptr;
+	R(*callback)(void*, Args...) = nullptr;
+
+public:
+	template<typename F, typename = std::enable_if_t<
+		!std::is_same_v<std::decay_t<F>, function_ref> && std::is_invocable_r_v<R, F&, Args...>
+	>>
+	function_ref(F&& f) :
+		obj((void*)std::addressof(f)),
+		callback([](void* obj, Args... args) -> R {
+			return (*reinterpret_cast<std::add_pointer_t<F>>(obj))(std::forward<Args>(args)...);
+		})
+	{}
+
+	R operator()(Args... args) const {
+		return callback(obj, std::forward<Args>(args)...);
+	}
+};
+
+} // namespace cppm
@@ -0,0 +1,180 @@
+#include "gcc_module_mapper.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
+#include <fmt/format.h>
+
+namespace fs = std::filesystem;
+
+namespace cppm {
+
+// the header units are requested by the path where the compiler found them (relative to its working directory)
+std::string normalize_header_path(const fs::path& path) {
+	return fs::absolute(path).lexically_normal().generic_string();
+}
+
+// the words are separated by spaces, the ones in single quotes can contain spaces and \ escapes
+std::vector<std::string> split_words(std::string_view line) {
+	std::vector<std::string> words;
+	std::size_t i = 0;
+	while (true) {
+		while (i < line.size() && (line[i] == ' ' || line[i] == '\t'))
+			++i;
+		if (i == line.size())
+			return words;
+		std::string word;
+		while (i < line.size() && line[i] != ' ' && line[i] != '\t') {
+			if (line[i] != '\'') {
+				word += line[i++];
+				continue;
+			}
+			for (++i; i < line.size() && line[i] != '\''; ++i) {
+				if (line[i] == '\\' && i + 1 < line.size()) {
+					char c = line[++i];
+					word += (c == 'n') ? '\n' : (c == 't') ? '\t' : c;
+				} else {
+					word += line[i];
+				}
+			}
+			++i; // the closing quote
+		}
+		words.push_back(std::move(word));
+	}
+}
+
+std::string quote_word(std::string_view word) {
+	auto is_safe = [](char c) {
+		return std::isalnum((unsigned char)c) || (c != '\0' && std::strchr("-+_/%.:@=,", c));
+	};
+	if (!word.empty() && std::all_of(word.begin(), word.end(), is_safe))
+		return (std::string)word;
+	std::string ret = "'";
+	for (char c : word) {
+		if (c == '\'' || c == '\\')
+			ret += '\\';
+		if (c == '\n')
+			ret += "\\n";
+		else if (c == '\t')
+			ret += "\\t";
+		else
+			ret += c;
+	}
+	ret += '\'';
+	return ret;
+}
+
+void GccModuleMapper::add_modules(ScanItemSetView item_set, const CollatedModuleInfo& info,
+	function_ref<std::string_view(scan_item_idx_t)> bmi_file_func)
+{
+	for (auto idx : item_set.items.indices()) {
+		if (!info.exports[idx].empty()) {
+			module_to_bmi[(std::string)info.exports[idx]] = (std::string)bmi_file_func(idx);
+		} else if (item_set.items[idx].is_header_unit) {
+			auto path = fs::path { item_set.item_root_path } / item_set.items[idx].path;
+			header_unit_to_bmi[normalize_header_path(path)] = (std::string)bmi_file_func(idx);
+		}
+	}
+}
+
+void GccModuleMapper::write_file(const std::string& path) const {
+	std::ofstream fout(path);
+	if (!fout)
+		throw std::runtime_error(fmt::format("failed to open '{}'", path));
+	fout << "$root " << quote_word(repo_dir) << "\n";
+	for (auto& [name, bmi] : module_to_bmi)
+		fout << quote_word(name) << " " << quote_word(bmi) << "\n";
+	for (auto& [header, bmi] : header_unit_to_bmi)
+		fout << quote_word(header) << " " << quote_word(bmi) << "\n";
+}
+
+GccModuleMapper GccModuleMapper::read_file(const std::string& path) {
+	std::ifstream fin(path);
+	if (!fin)
+		throw std::invalid_argument(fmt::format("{} does not exist", path));
+	GccModuleMapper mapper;
+	std::string line;
+	while (std::getline(fin, line)) {
+		auto words = split_words(line);
+		if (words.size() < 2 || words[0][0] == '#')
+			continue;
+		if (words[0] == "$root")
+			mapper.repo_dir = words[1];
+		else if (fs::path { words[0] }.is_absolute()) // the module names can't be absolute paths
+			mapper.header_unit_to_bmi[words[0]] = words[1];
+		else
+			mapper.module_to_bmi[words[0]] = words[1];
+	}
+	return mapper;
+}
+
+void GccModuleMapper::serve(std::istream& in, std::ostream& out) const {
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		// the requests in a batch end with a " ;" except for the last one, and so do the responses
+		bool continued = (!line.empty() && line.back() == ';' && (line.size() == 1 || line[line.size() - 2] == ' '));
+		if (continued)
+			line.resize(line.size() - 1);
+		out << respond(line) << (continued ? " ;\n" : "\n");
+		if (!continued)
+			out.flush();
+	}
+}
+
+std::string GccModuleMapper::respond(std::string_view request) const {
+	auto words = split_words(request);
+	if (words.empty())
+		return "ERROR 'empty request'";
+	auto& cmd = words[0];
+	auto error = [](std::string_view message) {
+		return "ERROR " + quote_word(message);
+	};
+	auto find_header_unit = [&](const std::string& path) -> const std::string* {
+		auto itr = header_unit_to_bmi.find(normalize_header_path(path));
+		return (itr != header_unit_to_bmi.end()) ? &itr->second : nullptr;
+	};
+
+	if (cmd == "HELLO")
+		return "HELLO 1 cppm_scanner_tool";
+	if (cmd == "MODULE-REPO")
+		return "PATHNAME " + quote_word(repo_dir);
+	if (cmd == "MODULE-COMPILED")
+		return "OK";
+	if (words.size() < 2)
+		return error(fmt::format("missing the argument of {}", cmd));
+	if (cmd == "MODULE-EXPORT" || cmd == "MODULE-IMPORT") {
+		auto itr = module_to_bmi.find(words[1]);
+		if (itr != module_to_bmi.end())
+			return "PATHNAME " + quote_word(itr->second);
+		if (auto bmi = find_header_unit(words[1]))
+			return "PATHNAME " + quote_word(*bmi);
+		return error(fmt::format("unknown module {}", words[1]));
+	}
+	if (cmd == "INCLUDE-TRANSLATE") {
+		// the header units that weren't scanned stay #includes
+		if (auto bmi = find_header_unit(words[1]))
+			return "PATHNAME " + quote_word(*bmi);
+		return "BOOL FALSE";
+	}
+	return error(fmt::format("unsupported request {}", cmd));
+}
+
+std::string GccModuleMapper::mapper_spec(std::string_view tool_path, std::string_view mapper_file) {
+	auto has_space = [](std::string_view str) {
+		return std::any_of(str.begin(), str.end(), [](char c) { return std::isspace((unsigned char)c); });
+	};
+	if (has_space(tool_path) || has_space(mapper_file))
+		return (std::string)mapper_file;
+	return fmt::format("|{} mapper --mapper_file={}", tool_path, mapper_file);
+}
+
+} // namespace cppm
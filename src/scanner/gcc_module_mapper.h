@@ -0,0 +1,45 @@
+#pragma once
+
+#include "scanner.h"
+#include "function_ref.h"
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace cppm {
+
+// a server for GCC's module mapper protocol, which GCC uses to ask where the BMI of each module
+// it imports/exports is when it needs it, instead of getting all of the references on the command line
+// e.g with -fmodule-mapper=|cppm_scanner_tool mapper --mapper_file=... GCC starts the tool for each TU
+// and then talks to it over the tool's stdin/stdout
+struct GccModuleMapper
+{
+	// the relative BMI paths are relative to this
+	std::string repo_dir = ".";
+	// the header units are found by their normalized path
+	std::unordered_map<std::string, std::string> module_to_bmi, header_unit_to_bmi;
+
+	// add the modules and header units exported by the items
+	void add_modules(ScanItemSetView item_set, const CollatedModuleInfo& info,
+		function_ref<std::string_view(scan_item_idx_t)> bmi_file_func);
+
+	// this uses the format of the files that GCC can also read directly (with -fmodule-mapper=file):
+	// a "$root <repo dir>" line, and then a "<module name or header path> <BMI file>" line for each module
+	void write_file(const std::string& path) const;
+	static GccModuleMapper read_file(const std::string& path);
+
+	// answers the requests until the input is closed (i.e when the compiler is done)
+	void serve(std::istream& in, std::ostream& out) const;
+
+	// the response to a single request line, without the batch continuation
+	std::string respond(std::string_view request) const;
+
+	// the -fmodule-mapper value for GCC to start the tool as the mapper of a TU
+	// note: GCC splits the program's command line on whitespace without handling any quotes or escapes,
+	// so if one of the paths has whitespace then GCC is given the mapper file to read directly instead
+	static std::string mapper_spec(std::string_view tool_path, std::string_view mapper_file);
+};
+
+} // namespace cppm
@@ -4,6 +4,13 @@
 #include <filesystem>
 #include <unordered_set>
 #include <string_view>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <cctype>
 
 #include <nlohmann/json.hpp>
 #pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
@@ -13,11 +20,26 @@
 #include "cmd_line_utils.h"
 #include "scanner.h"
 #include "trace.h"
+#include "parallel.h"
+#include "file_time.h"
+#include "lmdb_path_store.h"
+#include "critical_path.h"
+#include "bmi_cache.h"
+#include "gcc_module_mapper.h"
 
 namespace fs = std::filesystem;
 
 namespace cppm {
 
+// appends the escaped string to buf
+void ninja_escape(fmt::memory_buffer& buf, std::string_view s) {
+	for (char c : s) {
+		if (c == '&' || c == ' ' || c == ':')
+			buf.push_back('$');
+		buf.push_back(c);
+	}
+}
+
 std::string ninja_escape(std::string_view s) {
 	std::string ret;
 	int nr = 0;
@@ -33,6 +55,20 @@ std::string ninja_escape(std::string_view s) {
 	return ret;
 }
 
+// for the depfiles read by ninja, which use the Makefile syntax
+std::string depfile_escape(std::string_view s) {
+	std::string ret;
+	ret.reserve(s.size());
+	for (char c : s) {
+		if (c == ' ' || c == '#')
+			ret += '\\';
+		else if (c == '$')
+			ret += '$';
+		ret += c;
+	}
+	return ret;
+}
+
 std::string NinjaGenerator::comp_db_to_read(std::string_view comp_db_path, const Scanner::Config& c) {
 	if (comp_db_path != "")
 		return (std::string)comp_db_path;
@@ -45,65 +81,175 @@ std::string NinjaGenerator::comp_db_to_read(std::string_view comp_db_path, const
 
 std::string get_output_file(ScanItem& item, Scanner::Config& c) {
 	auto& cmd = c.item_set.commands[item.command_idx];
-	return find_command_line_argument(cmd, "/Fo"); // todo:
+	std::string output_file = find_command_line_argument(cmd, "/Fo"); // todo:
+	if (output_file.empty()) // e.g clang or gcc
+		output_file = find_command_line_argument(cmd, " -o ");
+	return output_file;
 }
 
-std::string get_input_file(ScanItem& item, Scanner::Config& c) {
-	return fs::relative(item.path, c.int_dir).string(); // shorten the path a bit
+using mdb::path_relativizer;
+
+std::string_view get_input_file(ScanItem& item, path_relativizer& rel) {
+	return rel.relative(item.path); // shorten the path a bit
+}
+
+// like fs::path::replace_extension but without converting to/from a path
+std::string replace_extension(std::string_view path, std::string_view ext) {
+	std::size_t name_start = path.find_last_of("/\\");
+	name_start = (name_start == std::string_view::npos) ? 0 : name_start + 1;
+	std::size_t dot = path.rfind('.');
+	// e.g ".rsp" is a file name without an extension, like for fs::path
+	if (dot == std::string_view::npos || dot <= name_start)
+		dot = path.size();
+	std::string ret;
+	ret.reserve(dot + ext.size());
+	ret.append(path.data(), dot);
+	ret.append(ext);
+	return ret;
 }
 
 std::string get_response_file(std::string_view output_file) {
-	return fs::path { output_file }.replace_extension(".rsp").string();
+	return replace_extension(output_file, ".rsp");
 }
 
-std::string get_bmi_file(std::string_view output_file) {
-	return fs::path { output_file }.replace_extension(".ifc").string();
+using Format = ModuleCommandGenerator::Format;
+
+std::string get_bmi_file(std::string_view output_file, Format format) {
+	if (format.isGCC())
+		return replace_extension(output_file, ".gcm");
+	if (format.isClang() || format.isClangCl())
+		return replace_extension(output_file, ".pcm");
+	return replace_extension(output_file, ".ifc");
 }
 
-constexpr auto dyndeps_file_name = "dyndeps.ninja";
+// the options of the module flags that are the same for all of the items
+struct ModuleFlagsOptions {
+	Format format;
+	// see write_gcc_module_mapper
+	std::string gcc_module_mapper;
+	// for the Clang formats: the BMIs of the named modules go into {int_dir}/pcm/{target}, so that
+	// the items only need to reference their direct imports and clang finds the rest there
+	vector_map<target_idx_t, std::string> clang_prebuilt_module_paths;
+
+	ModuleFlagsOptions(std::string_view cmd_format) : format(Format::from_string(cmd_format)) {}
+
+	void set_clang_prebuilt_module_paths(ScanItemSetView item_set, std::string_view int_dir) {
+		for (auto& target : item_set.targets) {
+			// the target names are used as directory names, so anything else than e.g a-z, 0-9 becomes a _
+			std::string dir_name = (std::string)target;
+			for (char& c : dir_name)
+				if (!std::isalnum((unsigned char)c) && c != '-' && c != '.')
+					c = '_';
+			auto path = fs::absolute(fs::path { int_dir } / "pcm" / dir_name);
+			std::error_code ec;
+			fs::create_directories(path, ec); // clang doesn't create the directory of its output
+			clang_prebuilt_module_paths.push_back(path.generic_string());
+		}
+	}
 
-void add_scanner(std::ofstream& fout, std::string& comp_db_path, Scanner::Config& c)
+	std::string get_bmi_file(scan_item_idx_t idx, ScanItemSetView item_set, const CollatedModuleInfo& info,
+		std::string_view output_file) const
+	{
+		if (!clang_prebuilt_module_paths.empty() && !info.exports[idx].empty())
+			return ModuleCommandGenerator::prebuilt_bmi_file(
+				clang_prebuilt_module_paths[item_set.items[idx].target_idx], info.exports[idx]);
+		return cppm::get_bmi_file(output_file, format);
+	}
+
+	void apply(ModuleCommandGenerator& cmd_gen) const {
+		cmd_gen.gcc_module_mapper = gcc_module_mapper;
+		cmd_gen.clang_prebuilt_module_paths = clang_prebuilt_module_paths;
+	}
+};
+
+// GCC asks the tool where the BMIs are through its module mapper protocol, so the BMIs are written to a file for it
+// returns the -fmodule-mapper value for the items
+std::string write_gcc_module_mapper(ScanItemSetView item_set, const CollatedModuleInfo& info,
+	const vector_map<scan_item_idx_t, std::string>& bmi_files, std::string_view int_dir)
 {
-	fmt::print(fout, "rule scan\n command = $cmd\n");
+	GccModuleMapper mapper;
+	mapper.add_modules(item_set, info, [&](scan_item_idx_t idx) -> std::string_view {
+		return bmi_files[idx];
+	});
+	std::string mapper_file = fs::absolute(fs::path { int_dir } / "module_mapper.txt").string();
+	mapper.write_file(mapper_file);
+	return GccModuleMapper::mapper_spec(executable_path(), mapper_file);
+}
+
+std::string get_cache_key_file(std::string_view output_file) {
+	return replace_extension(output_file, ".cachekey");
+}
+
+// with a BMI cache the cc commands are wrapped like this, followed by the key file and then "-- <the compile command>"
+// note: this is done for all of the items with gen_dynamic since it doesn't know yet which ones produce a BMI,
+// but the wrapper just runs the command for the ones that don't have a key file
+std::string get_cache_compile_cmd(std::string_view bmi_cache_dir) {
+	return fmt::format("\"{}\" # cache_compile --bmi_cache_dir=\"{}\" ", executable_path(), bmi_cache_dir);
+}
+
+constexpr auto dyndeps_file_name = "dyndeps.ninja";
 
+// the command line used to invoke this tool from the generated build.ninja
+std::string get_tool_cmd(std::string_view command, std::string& comp_db_path, Scanner::Config& c)
+{
 	// note: the # is there so we don't override the command line with command_line.txt
-	std::string scan_cmd = fmt::format("\"{}\" # scan ", executable_path());
+	std::string cmd = fmt::format("\"{}\" # {} ", executable_path(), command);
 	auto add = [&](std::string_view var, std::string_view var_name) {
-		if (var != "" && var != "./" && var != ".") scan_cmd += fmt::format("--{}=\"{}\" ", var_name, var);
+		if (var != "" && var != "./" && var != ".") cmd += fmt::format("--{}=\"{}\" ", var_name, var);
 	};
 	add(comp_db_path, "comp_db_path");
 	add(c.tool_path, "tool_path");
 	add(c.db_path, "db_path");
 	add(c.int_dir, "int_dir");
+	return cmd;
+}
+
+void add_scanner(std::ofstream& fout, std::string& comp_db_path, Scanner::Config& c, bool prefetch_outputs,
+	const std::string& bmi_cache_dir, const std::string& cmd_format)
+{
+	fmt::print(fout, "rule scan\n command = $cmd\n");
+
+	std::string scan_cmd = get_tool_cmd("scan", comp_db_path, c);
+	if (prefetch_outputs) scan_cmd += "--prefetch_outputs ";
+	if (bmi_cache_dir != "") scan_cmd += fmt::format("--bmi_cache_dir=\"{}\" ", bmi_cache_dir);
+	if (cmd_format != "msvc") scan_cmd += fmt::format("--cmd_format={} ", cmd_format);
 	// ninja is intended to be invoked from the intdir so this doesn't need a relative path:
-	std::string dyndeps_file = dyndeps_file_name;
-	std::string dyndeps_file_esc = ninja_escape(dyndeps_file);
-	std::string outputs = dyndeps_file_esc;
+	std::string outputs = ninja_escape(dyndeps_file_name);
 	std::string inputs = "";
+	path_relativizer rel { c.int_dir };
 	for (auto& item : c.item_set.items) {
-		inputs += ninja_escape(fs::relative(item.path, c.int_dir).string()) + " ";
+		inputs += ninja_escape(rel.relative(item.path));
+		inputs += " ";
 	}
 	fmt::print(fout, "build {}: scan {}\n cmd = {}\n deps = msvc\n", outputs, inputs, scan_cmd);
 }
 
-void add_sources(std::ofstream& fout, Scanner::Config& c)
+void add_sources(std::ofstream& fout, Scanner::Config& c, const std::string& bmi_cache_dir)
 {
 	fmt::print(fout, "rule cc\n command = $cmd\n");
 
-	// todo: avoid path allocations as much as possible here
 	std::string dyndeps_file = dyndeps_file_name;
 	std::string dyndeps_file_esc = ninja_escape(dyndeps_file);
+
+	// the edges are formatted into a reused buffer to avoid allocating for each path
+	path_relativizer rel { c.int_dir };
+	std::string cache_compile_cmd = (bmi_cache_dir != "") ? get_cache_compile_cmd(bmi_cache_dir) : "";
+	fmt::memory_buffer buf;
 	for (auto& item : c.item_set.items) {
 		auto& cmd = c.item_set.commands[item.command_idx];
 
 		std::string output_file = get_output_file(item, c);
-		std::string outputs = ninja_escape(output_file);
 
-		std::string input_file = get_input_file(item, c);
-		std::string rsp_file = get_response_file(output_file);
-		std::string inputs = fmt::format("{} || {}", ninja_escape(input_file), dyndeps_file_esc);
-		fmt::print(fout, "build {}: cc {}\n cmd = {} \"@{}\"\n dyndep = {}\n",
-			outputs, inputs, cmd, rsp_file, dyndeps_file);
+		buf.clear();
+		fmt::format_to(buf, "build ");
+		ninja_escape(buf, output_file);
+		fmt::format_to(buf, ": cc ");
+		ninja_escape(buf, get_input_file(item, rel));
+		fmt::format_to(buf, " || {}\n cmd = ", dyndeps_file_esc);
+		if (cache_compile_cmd != "")
+			fmt::format_to(buf, "{}--cache_key_file=\"{}\" -- ", cache_compile_cmd, get_cache_key_file(output_file));
+		fmt::format_to(buf, "{} \"@{}\"\n dyndep = {}\n", cmd, get_response_file(output_file), dyndeps_file);
+		fout.write(buf.data(), buf.size());
 	}
 }
 
@@ -117,9 +263,13 @@ int NinjaGenerator::gen_dynamic(std::string& comp_db_path, Scanner::Config& c)
 
 	std::ofstream fout(fs::path { c.int_dir } / "build.ninja");
 
+	// the cache can be shared between build dirs so this shouldn't depend on where the tools are run from
+	if (bmi_cache_dir != "")
+		bmi_cache_dir = fs::absolute(bmi_cache_dir).string();
+
 	//fmt::print(fout, "msvc_deps_prefix = -\n");
-	add_scanner(fout, comp_db_path, c);
-	add_sources(fout, c);
+	add_scanner(fout, comp_db_path, c, prefetch_outputs, bmi_cache_dir, cmd_format);
+	add_sources(fout, c, bmi_cache_dir);
 	
 	//fmt::print(stderr, "gen_dynamic");
 	return 0;
@@ -127,21 +277,144 @@ int NinjaGenerator::gen_dynamic(std::string& comp_db_path, Scanner::Config& c)
 
 DECL_STRONG_ID_INV(module_id_t, 0);
 
+// stats the outputs of the up to date items on a few threads while the scanner is running
+// so that they're already in the OS's cache by the time ninja restats them after the scan
+struct OutputPrefetcher {
+	Scanner::Config& c;
+	Format format;
+	// see header_unit_bmis in NinjaGenerator::scan
+	bool header_unit_bmis;
+	struct queued_item {
+		scan_item_idx_t idx;
+		bool has_export;
+	};
+	std::mutex queue_mutex;
+	std::condition_variable queue_cv;
+	std::vector<queued_item> queue;
+	bool done = false;
+	std::vector<std::future<void>> workers;
+	std::atomic<std::size_t> nr_stated = 0;
+	std::atomic<int64_t> stat_time_us = 0;
+
+	using clock = std::chrono::steady_clock;
+
+	OutputPrefetcher(Scanner::Config& c, Format format, bool header_unit_bmis) :
+		c(c), format(format), header_unit_bmis(header_unit_bmis)
+	{
+		std::size_t nr_workers = std::min(default_nr_threads(), std::size_t { 4 });
+		for (std::size_t i = 0; i < nr_workers; ++i)
+			workers.push_back(eager_future([this] { work(); }));
+	}
+
+	// note: finish() should be called explicitly to get the worker's exceptions,
+	// this only makes sure that the workers are joined without throwing from the destructor
+	~OutputPrefetcher() {
+		try {
+			finish();
+		} catch (...) {
+		}
+	}
+
+	void add(scan_item_idx_t idx, bool has_export) {
+		std::lock_guard lock { queue_mutex };
+		queue.push_back({ idx, has_export });
+		queue_cv.notify_one();
+	}
+
+	void stat(const std::string& path) {
+		std::error_code ec; // it doesn't matter if e.g the file doesn't exist yet
+		(void)fs::last_write_time(path, ec);
+		nr_stated++;
+	}
+
+	void work() {
+		std::vector<queued_item> items;
+		while (true) {
+			{
+				std::unique_lock lock { queue_mutex };
+				queue_cv.wait(lock, [&] { return done || !queue.empty(); });
+				if (queue.empty())
+					return;
+				std::swap(items, queue);
+			}
+			auto start = clock::now();
+			for (auto [idx, has_export] : items) {
+				auto& item = c.item_set.items[idx];
+				std::string output_file = get_output_file(item, c);
+				stat(output_file);
+				stat(get_response_file(output_file));
+				if (has_export || (item.is_header_unit && header_unit_bmis))
+					stat(get_bmi_file(output_file, format));
+			}
+			stat_time_us += std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+			items.clear();
+		}
+	}
+
+	void finish() {
+		if (workers.empty())
+			return;
+		auto start = clock::now();
+		{
+			std::lock_guard lock { queue_mutex };
+			done = true;
+			queue_cv.notify_all();
+		}
+		// all of the workers are joined before rethrowing the first exception (if any)
+		std::exception_ptr first_exception;
+		for (auto& worker : workers) {
+			try {
+				worker.get();
+			} catch (...) {
+				if (!first_exception)
+					first_exception = std::current_exception();
+			}
+		}
+		workers.clear();
+		if (first_exception)
+			std::rethrow_exception(first_exception);
+		auto wait_time_us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+		// the stats that happened before we had to wait for them were hidden behind the scanner
+		TRACE_COUNTER("outputs prefetched", nr_stated.load());
+		TRACE_COUNTER("prefetch time saved (us)", std::max<int64_t>(0, stat_time_us - wait_time_us));
+	}
+};
+
 struct DepsCollector : public DepInfoObserver {
 	std::unordered_set<std::string> all_file_deps;
+	// if set then the file deps of each item are collected here as well, e.g for the BMI cache keys
+	vector_map<scan_item_idx_t, std::vector<std::string>>* item_file_deps = nullptr;
+	OutputPrefetcher* prefetcher = nullptr;
+	scan_item_idx_t current_idx = {};
+	bool current_out_of_date = false;
+	bool current_has_export = false;
+	void results_for_item(scan_item_idx_t item_idx, bool out_of_date) override {
+		current_idx = item_idx;
+		current_out_of_date = out_of_date;
+		current_has_export = false;
+	}
+	void export_module(DataBlockView) override {
+		current_has_export = true;
+	}
+	void add_file_dep(std::string_view path) {
+		all_file_deps.insert((std::string)path);
+		if (item_file_deps)
+			(*item_file_deps)[current_idx].push_back((std::string)path);
+	}
 	void include_header(DataBlockView path) override {
-		all_file_deps.insert((std::string)std::get<std::string_view>(path));
+		add_file_dep(std::get<std::string_view>(path));
 	}
 	void other_file_dep(DataBlockView path) override {
-		all_file_deps.insert((std::string)std::get<std::string_view>(path));
+		add_file_dep(std::get<std::string_view>(path));
+	}
+	void item_finished() override {
+		// the outputs of the out of date items will be rebuilt anyway
+		if (prefetcher && !current_out_of_date)
+			prefetcher->add(current_idx, current_has_export);
 	}
 };
 
-// todo: if the file and all of its transitive dependencies are up-to-date then
-// we should be able to know that the command shouldn't change without reading in the file
-// but it's possible that all of those were successfully scanned and we crashed before writing the file
-// so maybe just stat the file instead of reading it, check that it's after the last scan, 
-// or we could store a record in the DB after the file is written and check that without additional I/O ?
+// note: NinjaGenerator::scan only gets here if the item's fingerprint in the DB doesn't match
 struct write_if_changed_guard {
 	fmt::memory_buffer &buf;
 	std::string_view file_name;
@@ -164,9 +437,152 @@ struct write_if_changed_guard {
 	}
 };
 
-int NinjaGenerator::scan(std::string& comp_db_path, Scanner::Config& c)
+// unlike write_if_changed_guard this compares the whole file, returns true if it was written
+bool write_file_if_changed(const fmt::memory_buffer& buf, const std::string& file_name) {
+	{
+		std::ifstream fin(file_name, std::ios::binary | std::ios::ate);
+		if (fin && (std::size_t)fin.tellg() == buf.size()) {
+			std::string contents(buf.size(), '\0');
+			fin.seekg(0);
+			if (fin.read(contents.data(), contents.size()) &&
+				std::memcmp(contents.data(), buf.data(), buf.size()) == 0)
+			{
+				return false;
+			}
+		}
+	}
+	std::ofstream fout(file_name, std::ios::binary);
+	fout.write(buf.data(), buf.size());
+	return true;
+}
+
+// the duration (in ms) of the last run of the edge that built each output, from ninja's .ninja_log
+std::unordered_map<std::string, uint64_t> read_ninja_log_durations(const fs::path& log_path) {
+	std::unordered_map<std::string, uint64_t> durations;
+	std::ifstream fin(log_path);
+	std::string line;
+	while (std::getline(fin, line)) {
+		if (line.empty() || line[0] == '#') // e.g the "# ninja log v5" header
+			continue;
+		// start \t end \t mtime \t output \t command hash
+		std::size_t start_end = line.find('\t');
+		std::size_t end_end = line.find('\t', start_end + 1);
+		std::size_t mtime_end = line.find('\t', end_end + 1);
+		std::size_t output_end = line.find('\t', mtime_end + 1);
+		if (output_end == std::string::npos)
+			continue;
+		uint64_t start = std::strtoull(line.c_str(), nullptr, 10);
+		uint64_t end = std::strtoull(line.c_str() + start_end + 1, nullptr, 10);
+		// the later entries are from the more recent builds
+		durations[line.substr(mtime_end + 1, output_end - mtime_end - 1)] = (end > start) ? end - start : 0;
+	}
+	return durations;
+}
+
+// the compile times of the items in the last build, for the ones that aren't in the log
+// this uses the average, so that the critical paths are mostly decided by the module graph before the first build
+vector_map<scan_item_idx_t, uint64_t> get_item_costs(const fs::path& log_path,
+	const vector_map<scan_item_idx_t, std::string>& output_files)
+{
+	vector_map<scan_item_idx_t, uint64_t> costs;
+	costs.resize(output_files.size());
+	auto durations = read_ninja_log_durations(log_path);
+	if (durations.empty()) {
+		std::fill(costs.begin(), costs.end(), 1);
+		return costs;
+	}
+	uint64_t total = 0, nr_known = 0;
+	for (auto i = scan_item_idx_t { 0 }; i < output_files.size(); ++i) {
+		auto itr = durations.find(output_files[i]);
+		if (itr != durations.end()) {
+			costs[i] = std::max<uint64_t>(itr->second, 1);
+			total += costs[i];
+			nr_known++;
+		}
+	}
+	uint64_t average = (nr_known > 0) ? std::max<uint64_t>(total / nr_known, 1) : 1;
+	for (auto& cost : costs)
+		if (cost == 0)
+			cost = average;
+	return costs;
+}
+
+// the digests of the files in the BMI cache keys are kept in the scanner's DB, so the unchanged files aren't read on each scan
+// note: the DB is just a cache for these, so if it fails then the files are read again
+struct ScannerFileDigestStore : public FileDigestStore {
+	Scanner& scanner;
+	const Scanner::ConfigView& config;
+
+	ScannerFileDigestStore(Scanner& scanner, const Scanner::ConfigView& config) : scanner(scanner), config(config) {}
+
+	std::vector<FileDigest> get(tcb::span<const std::string_view> files) override {
+		try {
+			return scanner.get_file_digests(config, files);
+		} catch (std::exception& e) {
+			fmt::print(stderr, "failed to read the file digests: {}\n", e.what());
+			return std::vector<FileDigest>(files.size());
+		}
+	}
+
+	void put(tcb::span<const std::string_view> files, tcb::span<const FileDigest> digests) override {
+		try {
+			scanner.put_file_digests(config, files, digests);
+		} catch (std::exception& e) {
+			fmt::print(stderr, "failed to store the file digests: {}\n", e.what());
+		}
+	}
+};
+
+// the BMI cache key of an item depends on the contents of its source and of the files it depends on,
+// so the key files are rewritten (and the compiles rerun, mostly from the cache) whenever any of those change
+// note: the items that don't produce a BMI but were rescanned get their key file removed, in case they used to produce one
+void write_bmi_cache_key_files(ScanItemSetView item_set, ModuleVisitor& module_visitor, const ModuleFlagsOptions& flags_options,
+	FileDigestStore& digest_store, vector_map<scan_item_idx_t, std::vector<std::string>> file_deps,
+	const vector_map<scan_item_idx_t, Scanner::Result>& results,
+	const vector_map<scan_item_idx_t, std::string>& output_files,
+	const vector_map<scan_item_idx_t, std::string>& bmi_files)
 {
 	TRACE();
+	ModuleCommandGenerator cmd_gen { item_set, module_visitor };
+	flags_options.apply(cmd_gen);
+	vector_map<scan_item_idx_t, std::string> commands;
+	commands.resize(item_set.items.size());
+	for (auto i : item_set.items.indices()) {
+		if (bmi_files[i].empty())
+			continue;
+		cmd_gen.generate(i, flags_options.format, [&](scan_item_idx_t idx) -> std::string_view {
+			return bmi_files[idx];
+		});
+		commands[i] = normalize_command(fmt::format("{} {}", item_set.commands[item_set.items[i].command_idx],
+			std::string_view { cmd_gen.cmd_buf.data(), cmd_gen.cmd_buf.size() }));
+		file_deps[i].insert(file_deps[i].begin(), (std::string)item_set.items[i].path);
+	}
+	auto keys = compute_bmi_cache_keys(module_visitor, commands, file_deps, &digest_store);
+
+	std::size_t nr_written = 0;
+	fmt::memory_buffer buf;
+	for (auto i : item_set.items.indices()) {
+		std::string key_file = get_cache_key_file(output_files[i]);
+		std::error_code ec;
+		if (bmi_files[i].empty()) {
+			if (results[i].ood != ood_state::up_to_date)
+				fs::remove(key_file, ec);
+			continue;
+		}
+		std::string contents = BmiCacheKeyFile { keys[i], { output_files[i], bmi_files[i] } }.to_string();
+		buf.clear();
+		buf.append(contents.data(), contents.data() + contents.size());
+		fs::path key_dir = fs::path { key_file }.parent_path();
+		if (!key_dir.empty())
+			fs::create_directories(key_dir, ec);
+		if (write_file_if_changed(buf, key_file))
+			nr_written++;
+	}
+	TRACE_COUNTER("BMI cache key files written", nr_written);
+}
+
+void set_scan_defaults(Scanner::Config& c)
+{
 	if (c.tool_path == "") c.tool_path = R"(c:\Program Files\LLVM\bin\clang-scan-deps.exe)";
 
 	if (c.int_dir == "") c.int_dir = c.db_path; // can provide either one, for convenience
@@ -174,26 +590,49 @@ int NinjaGenerator::scan(std::string& comp_db_path, Scanner::Config& c)
 
 	if (c.int_dir == "") c.int_dir = "./"; // fs::relative doesn't work if this is ""
 	if (c.db_path == "") c.db_path = "./"; // the scanner throws an error otherwise
+}
+
+int NinjaGenerator::scan(std::string& comp_db_path, Scanner::Config& c)
+{
+	TRACE();
+	set_scan_defaults(c);
 
 	c.item_set = scan_item_set_from_comp_db(
 		NinjaGenerator::comp_db_to_read(comp_db_path, c)
 	);
 	DepsCollector collector;
 	c.observer = &collector;
+	vector_map<scan_item_idx_t, std::vector<std::string>> item_file_deps;
+	if (bmi_cache_dir != "") {
+		item_file_deps.resize(c.item_set.items.size());
+		collector.item_file_deps = &item_file_deps;
+	}
+	// note: the header units' BMIs are only outputs of their edges with the BMI cache, so that it restores them too
+	bool header_unit_bmis = (bmi_cache_dir != "");
+	std::optional<OutputPrefetcher> prefetcher;
+	if (prefetch_outputs) {
+		prefetcher.emplace(c, Format::from_string(cmd_format), header_unit_bmis);
+		collector.prefetcher = &*prefetcher;
+	}
 	ModuleVisitor module_visitor;
 	c.submit_previous_results = true;
 	c.collated_results = &module_visitor;
+	vector_map<scan_item_idx_t, ItemFingerprint> fingerprints;
+	c.fingerprints = &fingerprints;
 
 	auto config_owned_view = Scanner::ConfigOwnedView::from(c);
 	auto config_view = Scanner::ConfigView::from(config_owned_view);
 
 	Scanner scanner;
+	vector_map<scan_item_idx_t, Scanner::Result> results;
 	try {
-		scanner.scan(config_view);
+		results = scanner.scan(config_view);
 	} catch (std::exception & e) {
 		fmt::print(stderr, "scanner failed: {}\n", e.what());
 		return 1;
 	}
+	if (prefetcher)
+		prefetcher->finish();
 
 	if (!module_visitor.collate_success)
 		return 1;
@@ -203,53 +642,279 @@ int NinjaGenerator::scan(std::string& comp_db_path, Scanner::Config& c)
 		fmt::print("{} {}\n", deps_prefix, file); // ninja looks for the prefix
 	}
 
+	vector_map<scan_item_idx_t, std::string> output_files, ninja_bmi_files, bmi_files;
+	output_files.resize(c.item_set.items.size());
+	ninja_bmi_files.resize(c.item_set.items.size());
+	bmi_files.resize(c.item_set.items.size());
+	ModuleFlagsOptions flags_options { cmd_format };
+	if (flags_options.format.isClang() || flags_options.format.isClangCl())
+		flags_options.set_clang_prebuilt_module_paths(config_view.item_set, c.int_dir);
+	parallel_for(scan_item_idx_t { 0 }, c.item_set.items.size(), [&](scan_item_idx_t i) {
+		auto& item = c.item_set.items[i];
+		output_files[i] = get_output_file(item, c);
+		if (!module_visitor.exports[i].empty() || (item.is_header_unit && header_unit_bmis)) {
+			bmi_files[i] = flags_options.get_bmi_file(i, config_view.item_set, module_visitor, output_files[i]);
+			ninja_bmi_files[i] = ninja_escape(bmi_files[i]);
+		}
+	});
+	if (flags_options.format.isGCC())
+		flags_options.gcc_module_mapper = write_gcc_module_mapper(config_view.item_set, module_visitor, bmi_files, c.int_dir);
+
+	if (bmi_cache_dir != "") {
+		ScannerFileDigestStore digest_store { scanner, config_view };
+		write_bmi_cache_key_files(config_view.item_set, module_visitor, flags_options, digest_store, std::move(item_file_deps),
+			results, output_files, bmi_files);
+	}
+
+	// each chunk of items gets its own generator and dyndep buffer, since most of the time
+	// is spent on the response files, and then the buffers are written out in the order of the items
+	constexpr std::size_t min_items_per_chunk = 64;
+	std::size_t nr_items = (std::size_t)c.item_set.items.size();
+	std::size_t nr_chunks = std::min(default_nr_threads(), (nr_items + min_items_per_chunk - 1) / min_items_per_chunk);
+	nr_chunks = std::max(nr_chunks, std::size_t { 1 });
+	std::size_t chunk_size = (nr_items + nr_chunks - 1) / nr_chunks;
+	std::vector<fmt::memory_buffer> dd_bufs(nr_chunks);
+
+	// if an item and all of its transitive imports are up to date then its module flags can't have changed,
+	// so if its dyndep line is also the same and its response file wasn't touched since we last wrote it
+	// then there's nothing to generate, otherwise we still avoid reading in the response file if the flags are the same
+	auto up_to_date = [&](scan_item_idx_t idx) {
+		return results[idx].ood == ood_state::up_to_date && results[idx].scan == scan_state::success;
+	};
+	vector_map<scan_item_idx_t, ItemFingerprint> new_fingerprints;
+	new_fingerprints.resize(c.item_set.items.size());
+	// the checked response files are compared with the new flags, and only rewritten if they differ
+	std::atomic<std::size_t> nr_rsp_skipped = 0, nr_rsp_checked = 0;
+	std::atomic<bool> fingerprints_changed = false;
+	parallel_for(std::size_t { 0 }, nr_chunks, [&](std::size_t chunk_idx) {
+		TRACE_BLOCK("generate the dyndeps and the response files");
+		ModuleCommandGenerator cmd_gen { config_view.item_set, module_visitor };
+		flags_options.apply(cmd_gen);
+		auto& dd_buf = dd_bufs[chunk_idx];
+		fmt::memory_buffer dd_line;
+		std::size_t chunk_rsp_skipped = 0, chunk_rsp_checked = 0;
+		bool chunk_fingerprints_changed = false;
+		auto chunk_end = scan_item_idx_t { std::min(nr_items, (chunk_idx + 1) * chunk_size) };
+		for (auto i = scan_item_idx_t { chunk_idx * chunk_size }; i < chunk_end; ++i) {
+			std::string& output_file = output_files[i];
+			std::string response_file = get_response_file(output_file);
+
+			bool has_bmi = (!bmi_files[i].empty());
+			bool imports_up_to_date = up_to_date(i);
+
+			dd_line.clear();
+			fmt::format_to(dd_line, "build {}", ninja_escape(output_file));
+			if (has_bmi)
+				fmt::format_to(dd_line, " | {}", ninja_bmi_files[i]);
+			fmt::format_to(dd_line, ": dyndep | {}", ninja_escape(response_file));
+			if (has_bmi && bmi_cache_dir != "")
+				fmt::format_to(dd_line, " {}", ninja_escape(get_cache_key_file(output_file)));
+			module_visitor.visit_transitive_imports(cmd_gen.visit_state, i, [&](scan_item_idx_t exported_by_item_idx) {
+				fmt::format_to(dd_line, " {}", ninja_bmi_files[exported_by_item_idx]);
+				imports_up_to_date = imports_up_to_date && up_to_date(exported_by_item_idx);
+			});
+			fmt::format_to(dd_line, "\n");
+			dd_buf.append(dd_line.data(), dd_line.data() + dd_line.size());
+
+			auto& old_fp = fingerprints[i];
+			auto& new_fp = new_fingerprints[i];
+			new_fp.deps_hash = std::hash<std::string_view>{}(std::string_view { dd_line.data(), dd_line.size() });
+
+			// note: the write time is only checked if we had a valid fingerprint to compare it to
+			auto rsp_untouched = [&] {
+				return old_fp.is_valid() && old_fp.deps_hash == new_fp.deps_hash &&
+					get_last_write_time(fs::u8path(response_file)) == old_fp.write_time;
+			};
+			if (imports_up_to_date && rsp_untouched()) {
+				new_fp = old_fp;
+				chunk_rsp_skipped++;
+				continue;
+			}
+
+			cmd_gen.generate(i, flags_options.format, [&](scan_item_idx_t idx) -> std::string_view {
+				return bmi_files[idx];
+			});
+			new_fp.flags_hash = std::hash<std::string_view>{}(std::string_view { cmd_gen.cmd_buf.data(), cmd_gen.cmd_buf.size() });
+			if (old_fp.flags_hash == new_fp.flags_hash && rsp_untouched()) {
+				new_fp = old_fp;
+				chunk_rsp_skipped++;
+				continue;
+			}
+
+			{
+				write_if_changed_guard rsp_guard(cmd_gen.cmd_buf, response_file);
+			}
+			chunk_rsp_checked++;
+			// if the file couldn't be written (or stat-ed) then it's better not to record anything
+			auto write_time = get_last_write_time(fs::u8path(response_file));
+			new_fp.write_time = (write_time == std::numeric_limits<file_time_t>::max()) ? 0 : write_time;
+			if (new_fp != old_fp)
+				chunk_fingerprints_changed = true;
+		}
+		nr_rsp_skipped += chunk_rsp_skipped;
+		nr_rsp_checked += chunk_rsp_checked;
+		if (chunk_fingerprints_changed)
+			fingerprints_changed = true;
+	}, 1);
+	TRACE_COUNTER("response files skipped", nr_rsp_skipped.load());
+	TRACE_COUNTER("response files checked", nr_rsp_checked.load());
+
+	if (fingerprints_changed) {
+		try {
+			scanner.put_fingerprints(config_view, new_fingerprints);
+		} catch (std::exception & e) {
+			// the files were generated correctly so this isn't fatal, they'll just be checked again next time
+			fmt::print(stderr, "failed to store the fingerprints: {}\n", e.what());
+		}
+	}
+
 	std::ofstream dd_fout(dyndeps_file_name);
 	fmt::print(dd_fout, "ninja_dyndep_version = 1\n");
+	for (auto& dd_buf : dd_bufs)
+		dd_fout.write(dd_buf.data(), dd_buf.size());
+	return 0;
+}
+
+// scans the items now and writes a build.ninja with the module flags and the BMI dependencies baked in,
+// so ninja doesn't need to run the scanner or load any dyndep files, which is meant for when the sources don't change much
+// the build.ninja is regenerated by ninja when any of the sources or the files they include change,
+// which rescans the changed items with the DB and only rewrites the file if the module graph changed
+int NinjaGenerator::gen_static(std::string& comp_db_path, Scanner::Config& c)
+{
+	TRACE();
+	set_scan_defaults(c);
+
+	std::string comp_db = NinjaGenerator::comp_db_to_read(comp_db_path, c);
+	c.item_set = scan_item_set_from_comp_db(comp_db);
+	DepsCollector collector;
+	c.observer = &collector;
+	vector_map<scan_item_idx_t, std::vector<std::string>> item_file_deps;
+	if (bmi_cache_dir != "") {
+		bmi_cache_dir = fs::absolute(bmi_cache_dir).string();
+		item_file_deps.resize(c.item_set.items.size());
+		collector.item_file_deps = &item_file_deps;
+	}
+	ModuleVisitor module_visitor;
+	c.submit_previous_results = true;
+	c.collated_results = &module_visitor;
+
+	auto config_owned_view = Scanner::ConfigOwnedView::from(c);
+	auto config_view = Scanner::ConfigView::from(config_owned_view);
+
+	Scanner scanner;
+	vector_map<scan_item_idx_t, Scanner::Result> results;
+	try {
+		results = scanner.scan(config_view);
+	} catch (std::exception & e) {
+		fmt::print(stderr, "scanner failed: {}\n", e.what());
+		return 1;
+	}
+
+	// a static graph with missing edges would fail later in a confusing way
+	for (auto& res : results) {
+		if (res.scan == scan_state::failed) {
+			fmt::print(stderr, "failed to scan some of the items\n");
+			return 1;
+		}
+	}
+	if (!module_visitor.collate_success)
+		return 1;
 
 	vector_map<scan_item_idx_t, std::string> output_files, ninja_bmi_files, bmi_files;
 	output_files.resize(c.item_set.items.size());
 	ninja_bmi_files.resize(c.item_set.items.size());
 	bmi_files.resize(c.item_set.items.size());
-	for (auto i : c.item_set.items.indices()) {
-		auto& item = c.item_set.items[i];
-		output_files[i] = get_output_file(item, c);
-		if (!module_visitor.exports[i].empty()) {
-			bmi_files[i] = get_bmi_file(output_files[i]);
+	ModuleFlagsOptions flags_options { cmd_format };
+	if (flags_options.format.isClang() || flags_options.format.isClangCl())
+		flags_options.set_clang_prebuilt_module_paths(config_view.item_set, c.int_dir);
+	bool header_unit_bmis = (bmi_cache_dir != ""); // see scan
+	for (auto i = scan_item_idx_t { 0 }; i < c.item_set.items.size(); ++i) {
+		output_files[i] = get_output_file(c.item_set.items[i], c);
+		if (!module_visitor.exports[i].empty() || (c.item_set.items[i].is_header_unit && header_unit_bmis)) {
+			bmi_files[i] = flags_options.get_bmi_file(i, config_view.item_set, module_visitor, output_files[i]);
 			ninja_bmi_files[i] = ninja_escape(bmi_files[i]);
 		}
 	}
+	if (flags_options.format.isGCC())
+		flags_options.gcc_module_mapper = write_gcc_module_mapper(config_view.item_set, module_visitor, bmi_files, c.int_dir);
 
-	ModuleCommandGenerator cmd_gen { config_view.item_set, module_visitor };
-	
-	for (auto i : c.item_set.items.indices()) {
-		std::string& output_file = output_files[i];
-		std::string response_file = get_response_file(output_file);
+	if (bmi_cache_dir != "") {
+		ScannerFileDigestStore digest_store { scanner, config_view };
+		write_bmi_cache_key_files(config_view.item_set, module_visitor, flags_options, digest_store, std::move(item_file_deps),
+			results, output_files, bmi_files);
+	}
 
-		auto format = ModuleCommandGenerator::Format { ModuleCommandGenerator::MSVC } ;
-		cmd_gen.generate(i, format, [&](scan_item_idx_t idx) -> std::string_view {
-			return bmi_files[idx];
-		});
-		write_if_changed_guard rsp_guard(cmd_gen.cmd_buf, response_file);
+	// the sources and the headers are in a depfile rather than inputs of the regen edge,
+	// so that ninja regenerates build.ninja when one of them is removed, instead of failing because it's missing
+	// note: the depfile is left for ninja to read on each run (i.e no deps = gcc), since build.ninja
+	// is first generated outside of ninja and then ninja wouldn't know the deps until the first regen
+	path_relativizer rel { c.int_dir };
+	fmt::memory_buffer buf;
+	fmt::format_to(buf, "build.ninja:");
+	for (auto& item : c.item_set.items)
+		fmt::format_to(buf, " \\\n {}", depfile_escape(rel.relative(item.path)));
+	for (auto& file : collector.all_file_deps)
+		fmt::format_to(buf, " \\\n {}", depfile_escape(file));
+	fmt::format_to(buf, "\n");
+	write_file_if_changed(buf, (fs::path { c.int_dir } / "build.ninja.d").string());
+
+	buf.clear();
+	fmt::format_to(buf, "rule regen\n command = $cmd\n generator = 1\n restat = 1\n depfile = build.ninja.d\n");
+	fmt::format_to(buf, "build build.ninja: regen {}", ninja_escape(rel.relative(comp_db)));
+	std::string regen_cmd = get_tool_cmd("gen_static", comp_db_path, c);
+	if (bmi_cache_dir != "") regen_cmd += fmt::format("--bmi_cache_dir=\"{}\" ", bmi_cache_dir);
+	if (cmd_format != "msvc") regen_cmd += fmt::format("--cmd_format={} ", cmd_format);
+	if (edge_priorities) regen_cmd += "--edge_priorities ";
+	fmt::format_to(buf, "\n cmd = {}\n", regen_cmd);
+
+	// the interfaces with the longest chains of importers (weighted by the compile times of the last build)
+	// get a priority, so that a ninja that schedules by it doesn't start them after the leaves that don't block anything
+	// note: nothing in this repo reads these bindings and neither does stock ninja, they're only output
+	// for an external ninja fork that schedules by them, so they're only added with --edge_priorities
+	vector_map<scan_item_idx_t, uint64_t> costs;
+	CriticalPathInfo critical_paths;
+	if (edge_priorities) {
+		costs = get_item_costs(fs::path { c.int_dir } / ".ninja_log", output_files);
+		critical_paths = compute_critical_paths(module_visitor, costs);
+	}
 
-		bool has_export = (!module_visitor.exports[i].empty());
-		bool has_import = (!module_visitor.imports_item[i].empty());
+	fmt::format_to(buf, "rule cc\n command = $cmd\n");
+	ModuleCommandGenerator cmd_gen { config_view.item_set, module_visitor };
+	flags_options.apply(cmd_gen);
+	auto all_flags = cmd_gen.generate_all(flags_options.format, [&](scan_item_idx_t idx) -> std::string_view {
+		return bmi_files[idx];
+	});
+	std::string cache_compile_cmd = (bmi_cache_dir != "") ? get_cache_compile_cmd(bmi_cache_dir) : "";
+	for (auto i = scan_item_idx_t { 0 }; i < c.item_set.items.size(); ++i) {
+		auto& item = c.item_set.items[i];
+		auto& cmd = c.item_set.commands[item.command_idx];
 
-		fmt::print(dd_fout, "build {}", ninja_escape(output_file));
-		if (has_export)
-			fmt::print(dd_fout, " | {}", ninja_bmi_files[i]);
-		fmt::print(dd_fout, ": dyndep | {}", ninja_escape(response_file));
-		module_visitor.visit_transitive_imports(i, [&](scan_item_idx_t exported_by_item_idx) {
-			fmt::print(dd_fout, " {}", ninja_bmi_files[exported_by_item_idx]);
+		bool cached = (!bmi_files[i].empty() && cache_compile_cmd != "");
+		fmt::format_to(buf, "build {}", ninja_escape(output_files[i]));
+		if (!bmi_files[i].empty())
+			fmt::format_to(buf, " | {}", ninja_bmi_files[i]);
+		fmt::format_to(buf, ": cc {}", ninja_escape(get_input_file(item, rel)));
+		// the BMIs are implicit rather than order-only inputs so that changing an interface rebuilds its importers
+		bool first_import = true;
+		module_visitor.visit_transitive_imports(cmd_gen.visit_state, i, [&](scan_item_idx_t exported_by_item_idx) {
+			fmt::format_to(buf, first_import ? " | {}" : " {}", ninja_bmi_files[exported_by_item_idx]);
+			first_import = false;
 		});
-		fmt::print(dd_fout, "\n");
+		// the key file changes whenever the inputs do, even the ones that ninja doesn't know about
+		if (cached)
+			fmt::format_to(buf, first_import ? " | {}" : " {}", ninja_escape(get_cache_key_file(output_files[i])));
+		fmt::format_to(buf, "\n cmd = ");
+		if (cached)
+			fmt::format_to(buf, "{}--cache_key_file=\"{}\" -- ", cache_compile_cmd, get_cache_key_file(output_files[i]));
+		fmt::format_to(buf, "{}{}\n", cmd, all_flags[i]);
+		if (edge_priorities && critical_paths.longest_chain[i] > costs[i]) // only for the items that something imports
+			fmt::format_to(buf, " priority = {}\n downstream_weight = {}\n",
+				critical_paths.longest_chain[i], critical_paths.downstream_weight[i]);
 	}
-	return 0;
-}
 
-int NinjaGenerator::gen_static()
-{
-	fmt::print(stderr, "gen_static");
-	return 1;
+	// only touch build.ninja if the graph changed, so that ninja doesn't reload it after a regen edge that didn't change anything
+	write_file_if_changed(buf, (fs::path { c.int_dir } / "build.ninja").string());
+	return 0;
 }
 
 } // namespace cppm
\ No newline at end of file
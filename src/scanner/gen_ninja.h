@@ -8,17 +8,25 @@ namespace cppm {
 
 struct NinjaGenerator {
 	std::string incremental_scanner_path;
+	bool prefetch_outputs = false;
+	std::string bmi_cache_dir;
+	bool edge_priorities = false;
+	std::string cmd_format = "msvc";
 
 	auto command_line_opts() {
 		using namespace clara;
-		return Opt(incremental_scanner_path, "incremental scanner path")["--inc_scanner_path"];
+		return Opt(incremental_scanner_path, "incremental scanner path")["--inc_scanner_path"] |
+			Opt(prefetch_outputs)["--prefetch_outputs"]("stat the outputs of the up to date items while scanning") |
+			Opt(bmi_cache_dir, "dir")["--bmi_cache_dir"]("reuse the BMIs (and objects) of the interfaces and header units that were already built with the same inputs") |
+			Opt(cmd_format, "msvc|clangcl|clang|gcc")["--cmd_format"]("the compiler of the commands, for the module flags (default: msvc)") |
+			Opt(edge_priorities)["--edge_priorities"]("gen_static only: add priority/downstream_weight bindings to the interfaces' edges, this is only output for an external ninja fork that schedules by them, stock ninja ignores them and gen_dynamic doesn't write them");
 	}
 
 	int gen_dynamic(std::string& comp_db_path, cppm::Scanner::Config& c);
 
 	int scan(std::string& comp_db_path, cppm::Scanner::Config& c);
 
-	int gen_static();
+	int gen_static(std::string& comp_db_path, cppm::Scanner::Config& c);
 
 	static std::string comp_db_to_read(std::string_view comp_db_path, const cppm::Scanner::Config & c);
 };
@@ -86,6 +86,8 @@ struct path_id_store {
 	}
 
 	constexpr static char preferred_separator = '/';
+	// on windows the paths are upper-cased by normalize unless this is false, e.g for the paths written to files
+	bool fold_case = true;
 
 	bool is_relative(std::string_view path) {
 		if (path.empty())
@@ -173,7 +175,7 @@ struct path_id_store {
 				// drive letter depending on the environment variables
 				// todo: maybe fix the scanner instead, or only toupper the drive letter ?
 				// todo: unicode ?
-				*out++ = toupper(*in++);
+				*out++ = fold_case ? toupper(*in++) : *in++;
 			#else
 				*out++ = *in++;
 			#endif
@@ -226,8 +228,20 @@ struct path_id_store {
 		return itr->second;
 	}
 
-	auto open_db(mdb::mdb_txn<false>& txn_rw) {
-		return txn_rw.open_db<uint32_t, std::string_view>(db_name);
+	// like try_add, but the paths that aren't in the store get the invalid id instead of a new one
+	file_id_t find(std::string_view path) {
+		if (path.empty())
+			return current_path_id;
+		std::string_view normal_path = normalize(path);
+		auto itr = normal_path_to_id.find(normal_path);
+		file_id_t id = (itr != normal_path_to_id.end()) ? itr->second : file_id_t {};
+		normal_paths.free_last_alloc(normal_path.size());
+		return id;
+	}
+
+	template<bool read_only>
+	auto open_db(mdb::mdb_txn<read_only>& txn) {
+		return txn.template open_db<uint32_t, std::string_view>(db_name);
 	}
 
 	void commit_changes(mdb::mdb_txn<false>& txn_rw) {
@@ -254,8 +268,9 @@ struct path_id_store {
 		}
 	}
 
-	void read_paths(mdb::mdb_txn<false>& txn_rw, std::string_view item_root_path) {
-		auto db = open_db(txn_rw);
+	template<bool read_only>
+	void read_paths(mdb::mdb_txn<read_only>& txn, std::string_view item_root_path) {
+		auto db = open_db(txn);
 
 		normal_paths.clear();
 		id_to_normal_path_ref.clear();
@@ -284,12 +299,12 @@ struct path_id_store {
 		update_current_path(item_root_path);
 	}
 
-	template<typename path_idx_t>
-	auto get_file_ids(mdb::mdb_txn<false>& txn_rw, std::string_view item_root_path,
+	template<bool read_only, typename path_idx_t>
+	auto get_file_ids(mdb::mdb_txn<read_only>& txn, std::string_view item_root_path,
 		const vector_map<path_idx_t, std::string_view>& paths) {
 		vector_map<path_idx_t, file_id_t> file_ids;
 		file_ids.resize(paths.size());
-		read_paths(txn_rw, item_root_path);
+		read_paths(txn, item_root_path);
 		// todo: use multiple threads here to do the normalize/hash the paths
 		for (auto idx : paths.indices())
 			file_ids[idx] = try_add(paths[idx]);
@@ -300,9 +315,9 @@ struct path_id_store {
 		return normal_paths.get_alloc(id_to_normal_path_ref[file_id]);
 	}
 
-	// todo: this should work with a read-only txn as well
-	void print(mdb::mdb_txn<false>& txn_rw) {
-		read_paths(txn_rw, "");
+	template<bool read_only>
+	void print(mdb::mdb_txn<read_only>& txn) {
+		read_paths(txn, "");
 		for (auto id = file_id_t { 1 }; id < id_to_normal_path_ref.size(); ++id) {
 			auto path = normal_paths.get_alloc(id_to_normal_path_ref[id]);
 			fmt::print("{} - {}\n", id, path);
@@ -310,4 +325,66 @@ struct path_id_store {
 	}
 };
 
+// makes paths relative to a base directory with just string operations on the normalized paths,
+// so unlike fs::relative it doesn't access the file system, i.e symlinks are not resolved
+// note: the output uses the normalized separators of path_id_store, but it keeps the case of the path,
+// on windows only the common prefix is compared case-insensitively
+struct path_relativizer {
+	path_id_store<uint32_t> normalizer { nullptr };
+	std::string base; // normalized, with a trailing separator
+	std::string buf;
+
+	static bool same_char(char a, char b) {
+#ifdef _WIN32
+		return toupper((unsigned char)a) == toupper((unsigned char)b);
+#else
+		return a == b;
+#endif
+	}
+
+	// relative paths (including the base path) are relative to the current path
+	path_relativizer(std::string_view base_path, std::string_view current_path = "") {
+		normalizer.fold_case = false;
+		normalizer.update_current_path(current_path);
+		std::string_view normal_base = normalizer.normalize(base_path);
+		base = (std::string)normal_base;
+		normalizer.normal_paths.free_last_alloc(normal_base.size());
+		if (base.empty() || base.back() != normalizer.preferred_separator)
+			base += normalizer.preferred_separator;
+	}
+
+	// note: the returned string_view is only valid until the next call
+	std::string_view relative(std::string_view path) {
+		constexpr char sep = decltype(normalizer)::preferred_separator;
+		std::string_view normal_path = normalizer.normalize(path);
+		// the size of the common prefix, up to and including the last common separator
+		std::size_t common = 0;
+		std::size_t i = 0;
+		std::size_t n = std::min(normal_path.size(), base.size());
+		for (; i < n && same_char(normal_path[i], base[i]); ++i)
+			if (base[i] == sep)
+				common = i + 1;
+		if (i == normal_path.size() && i < base.size() && base[i] == sep)
+			common = i + 1; // the path is one of the base's parents
+		
+		buf.clear();
+		if (common == 0) {
+			// e.g on a different drive, this is still more useful than fs::relative's empty path
+			buf = normal_path;
+		} else {
+			for (std::size_t j = common; j < base.size(); ++j)
+				if (base[j] == sep)
+					buf += "../";
+			if (common < normal_path.size())
+				buf.append(normal_path.data() + common, normal_path.size() - common);
+			else if (!buf.empty())
+				buf.pop_back(); // "../" -> ".."
+			else
+				buf = ".";
+		}
+		normalizer.normal_paths.free_last_alloc(normal_path.size());
+		return buf;
+	}
+};
+
 } // namespace mdb
\ No newline at end of file
@@ -18,24 +18,29 @@ struct id_store {
 
 	id_store(const char* db_name) : db_name(db_name) {}
 
-	auto open_db(mdb::mdb_txn<false>& txn_rw) {
-		return txn_rw.open_db<id_t, entry_t>(db_name);
+	template<bool read_only>
+	auto open_db(mdb::mdb_txn<read_only>& txn) {
+		return txn.template open_db<id_t, entry_t>(db_name);
 	}
 
 	// note: this doesn't work if called after update_data
-	template<typename idx_t, typename F>
-	void get_data(mdb::mdb_txn<false>& txn_rw, const vector_map<idx_t, id_t>& ids, F&& data_func) {
-		auto db = open_db(txn_rw);
+	template<bool read_only, typename idx_t, typename F>
+	void get_data(mdb::mdb_txn<read_only>& txn, const vector_map<idx_t, id_t>& ids, F&& data_func) {
+		auto db = open_db(txn);
 
+		std::vector<idx_t> lookup_idxs;
+		std::vector<id_t> lookup_ids;
 		for (auto idx : ids.indices()) {
 			auto id = ids[idx];
 			if (id > db_max_id) // there's no data to fetch for new entires
 				continue;
-			try { // todo: don't use exceptions for this
-				data_func(idx, db.get(id));
-			}
-			catch (mdb::key_not_found_exception&) {}
+			lookup_idxs.push_back(idx);
+			lookup_ids.push_back(id);
 		}
+		db.get_many(lookup_ids, [&](std::size_t lookup_idx, auto entry) {
+			if (entry)
+				data_func(lookup_idxs[lookup_idx], *entry);
+		});
 	}
 
 	std::vector<std::pair<id_t, entry_t>> new_data;
@@ -51,13 +56,18 @@ struct id_store {
 	void commit_changes(mdb::mdb_txn<false>& txn_rw) {
 		auto db = open_db(txn_rw);
 
-		for (auto& [id, entry] : new_data)
-			db.put(id, entry);
+		std::vector<id_t> ids;
+		ids.reserve(new_data.size());
+		for (auto& data : new_data)
+			ids.push_back(data.first);
+		db.put_many(ids, [&](std::size_t idx) -> const entry_t& {
+			return new_data[idx].second;
+		});
 	}
 
-	// todo: this should work with a read-only txn as well
-	void print_data(mdb::mdb_txn<false>& txn_rw) {
-		auto db = open_db(txn_rw);
+	template<bool read_only>
+	void print_data(mdb::mdb_txn<read_only>& txn) {
+		auto db = open_db(txn);
 		// todo:
 	}
 };
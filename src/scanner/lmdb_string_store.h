@@ -21,15 +21,17 @@ struct string_id_store
 
 	string_id_store(const char* db_name) : db_name(db_name) {}
 
-	auto open_db(mdb::mdb_txn<false>& txn_rw) {
-		return txn_rw.open_db<id_t, std::string_view>(db_name, mdb::flags::open_db::integer_keys);
+	template<bool read_only>
+	auto open_db(mdb::mdb_txn<read_only>& txn) {
+		return txn.template open_db<id_t, std::string_view>(db_name, mdb::flags::open_db::integer_keys);
 	}
 
-	void init(mdb::mdb_txn<false>& txn_rw, id_t expected_size) {
+	template<bool read_only>
+	void init(mdb::mdb_txn<read_only>& txn, id_t expected_size) {
 		if (is_initialized)
 			return;
 
-		auto db = open_db(txn_rw);
+		auto db = open_db(txn);
 
 		// todo: maybe persist the hash map into the DB ? 
 
@@ -54,13 +56,13 @@ struct string_id_store
 		is_initialized = true;
 	}
 
-	template<typename idx_t>
-	auto get_ids(mdb::mdb_txn<false>& txn_rw, span_map<idx_t, std::string_view> strings)
+	template<bool read_only, typename idx_t>
+	auto get_ids(mdb::mdb_txn<read_only>& txn, span_map<idx_t, std::string_view> strings)
 	{
 		vector_map<idx_t, id_t> ids;
 		ids.resize(strings.size());
 
-		init(txn_rw, id_cast<id_t>(strings.size()));
+		init(txn, id_cast<id_t>(strings.size()));
 
 		for (auto i : strings.indices())
 			ids[i] = try_add(strings[i]);
@@ -83,8 +85,9 @@ struct string_id_store
 		return reverse_map[id];
 	}
 
-	const vector_map<id_t, std::string_view>& get_all_strings(mdb::mdb_txn<false>& txn_rw) {
-		init(txn_rw, {});
+	template<bool read_only>
+	const vector_map<id_t, std::string_view>& get_all_strings(mdb::mdb_txn<read_only>& txn) {
+		init(txn, {});
 		return reverse_map;
 	}
 
@@ -102,16 +105,18 @@ struct string_id_store
 
 		// note: put invalidates the strings that were read from the DB
 		// but this only uses the new strings so it's fine
-		for (auto id : reverse_map.indices()) {
-			auto str = reverse_map[id];
-			if(id > db_max_id)
-				db.put(id, str, mdb::flags::put::append);
-		}
+		std::vector<id_t> new_ids;
+		for (auto id : reverse_map.indices())
+			if (id > db_max_id)
+				new_ids.push_back(id);
+		db.put_many(new_ids, [&](std::size_t idx) {
+			return reverse_map[new_ids[idx]];
+		});
 	}
 
-	// todo: this should work with a read-only txn as well
-	void print(mdb::mdb_txn<false>& txn_rw) {
-		auto db = open_db(txn_rw);
+	template<bool read_only>
+	void print(mdb::mdb_txn<read_only>& txn) {
+		auto db = open_db(txn);
 		bool first = true;
 		for (auto&& [id, str] : db) {
 			if (first) { first = false; continue; }
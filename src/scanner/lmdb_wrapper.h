@@ -8,6 +8,11 @@
 
 #include "lmdb_wrapper_impl.h"
 
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <vector>
+
 namespace mdb {
 
 namespace flags {
@@ -17,6 +22,9 @@ namespace flags {
 		writemap = MDB_WRITEMAP,
 		nomeminit = MDB_NOMEMINIT,
 		fixedmap = MDB_FIXEDMAP,
+		nosync = MDB_NOSYNC,
+		nometasync = MDB_NOMETASYNC,
+		mapasync = MDB_MAPASYNC,
 	};
 
 	enum open_db : unsigned int {
@@ -35,6 +43,39 @@ namespace flags {
 template<bool read_only, typename Key, typename Value>
 struct mdb_dbi;
 
+namespace impl {
+
+// the keys serialized and ordered with the DB's comparison function,
+// so that they can be visited with a single cursor in the order they are in the DB
+template<typename Key>
+struct sorted_keys {
+	std::vector<char> bytes;
+	std::vector<std::size_t> ofs;
+	std::vector<std::size_t> order; // the indices of the keys in the DB's key order, repeated keys keep their order
+
+	sorted_keys(MDB_txn* txn, MDB_dbi dbi, tcb::span<const Key> keys) : ofs(keys.size() + 1), order(keys.size()) {
+		constexpr int max_key_len = 2048; // todo: use the value that lmdb was compiled with
+		char key_buf[max_key_len];
+		for (std::size_t idx = 0; idx < keys.size(); ++idx) {
+			MDB_val key = to_val(keys[idx], key_buf, max_key_len);
+			ofs[idx] = bytes.size();
+			bytes.insert(bytes.end(), (const char*)key.mv_data, (const char*)key.mv_data + key.mv_size);
+			order[idx] = idx;
+		}
+		ofs[keys.size()] = bytes.size();
+		std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+			MDB_val key_a = (*this)[a], key_b = (*this)[b];
+			return mdb_cmp(txn, dbi, &key_a, &key_b) < 0;
+		});
+	}
+
+	MDB_val operator[](std::size_t idx) {
+		return MDB_val { ofs[idx + 1] - ofs[idx], bytes.data() + ofs[idx] };
+	}
+};
+
+} // namespace impl
+
 struct key_not_found_exception : public std::exception {};
 
 template<bool read_only, typename Key, typename Value>
@@ -52,6 +93,64 @@ struct mdb_dbi_get {
 		handle_mdb_error(ret, "failed to get data");
 		return from_val<Value>(val);
 	}
+
+	// looks up all the keys with a single cursor, visiting them in the order of the keys in the DB,
+	// so nearby keys are found by stepping the cursor instead of searching from the root each time
+	// f(idx, value) is called once for each keys[idx] with an empty optional if the key is not found
+	template<typename F>
+	void get_many(tcb::span<const Key> keys, F&& f) {
+		using namespace impl;
+		using value_t = decltype(from_val<Value>(MDB_val {}));
+		auto parent = static_cast<mdb_dbi<read_only, Key, Value>*>(this);
+		if (keys.empty())
+			return;
+
+		sorted_keys<Key> sorted { parent->txn, parent->dbi, keys };
+
+		auto cursor = make_mdb_cursor(parent->txn, parent->dbi);
+		MDB_val cur_key = {}, cur_val = {};
+		bool positioned = false, at_end = false;
+		auto cursor_get = [&](MDB_cursor_op op) {
+			int ret = mdb_cursor_get(cursor.get(), &cur_key, &cur_val, op);
+			if (ret == MDB_NOTFOUND) { // not an error, there are no more keys after this one
+				at_end = true;
+				return;
+			}
+			handle_mdb_error(ret, "failed to get data");
+			positioned = true;
+		};
+
+		for (std::size_t idx : sorted.order) {
+			MDB_val key = sorted[idx];
+			int cmp = positioned ? mdb_cmp(parent->txn, parent->dbi, &cur_key, &key) : -1;
+			if (cmp < 0 && !at_end && positioned) {
+				// the keys are often dense so try the next key before searching for it
+				cursor_get(MDB_NEXT);
+				if (!at_end)
+					cmp = mdb_cmp(parent->txn, parent->dbi, &cur_key, &key);
+			}
+			if (cmp < 0 && !at_end) {
+				cur_key = key; // MDB_SET_RANGE moves to the first key >= this one
+				cursor_get(MDB_SET_RANGE);
+				if (!at_end)
+					cmp = mdb_cmp(parent->txn, parent->dbi, &cur_key, &key);
+			}
+			if (cmp == 0 && !at_end)
+				f(idx, std::optional<value_t> { from_val<Value>(cur_val) });
+			else
+				f(idx, std::optional<value_t> {});
+		}
+	}
+
+	// same as above but returns the results in the order of the keys
+	auto get_many(tcb::span<const Key> keys) {
+		using value_t = decltype(impl::from_val<Value>(MDB_val {}));
+		std::vector<std::optional<value_t>> values(keys.size());
+		get_many(keys, [&](std::size_t idx, std::optional<value_t> value) {
+			values[idx] = std::move(value);
+		});
+		return values;
+	}
 };
 
 template<bool read_only, typename Key, typename Value>
@@ -81,6 +180,64 @@ struct mdb_dbi_put<false, Key, Value> { // only for read/write transactions
 			handle_mdb_error(ret, "failed to put data");
 		}
 	}
+
+	// writes the values for all the keys with a single cursor, in the order of the keys in the DB
+	// the keys after the last one that was already in the DB are appended without searching for their position
+	// value_size(idx) should return the size of the serialized value for keys[idx]
+	// and write_value(idx, dst) should serialize it into the space reserved for it in the DB
+	// if a key is repeated then only the last value is kept
+	template<typename SizeF, typename WriteF>
+	void put_many_serialized(tcb::span<const Key> keys, SizeF&& value_size, WriteF&& write_value) {
+		using namespace impl;
+		auto parent = static_cast<mdb_dbi<false, Key, Value>*>(this);
+		if (keys.empty())
+			return;
+
+		sorted_keys<Key> sorted { parent->txn, parent->dbi, keys };
+		auto cursor = make_mdb_cursor(parent->txn, parent->dbi);
+
+		// the last key is copied since the puts can move the page that it's on
+		MDB_val last_key = {}, last_val = {};
+		int ret = mdb_cursor_get(cursor.get(), &last_key, &last_val, MDB_LAST);
+		bool appending = (ret == MDB_NOTFOUND); // not an error if the DB is empty
+		if (!appending)
+			handle_mdb_error(ret, "failed to get the last key");
+		std::vector<char> last_key_bytes { (const char*)last_key.mv_data, (const char*)last_key.mv_data + last_key.mv_size };
+		last_key.mv_data = last_key_bytes.data();
+
+		for (std::size_t i = 0; i < sorted.order.size(); ++i) {
+			std::size_t idx = sorted.order[i];
+			MDB_val key = sorted[idx];
+			if (i + 1 < sorted.order.size()) {
+				MDB_val next_key = sorted[sorted.order[i + 1]];
+				if (mdb_cmp(parent->txn, parent->dbi, &key, &next_key) == 0)
+					continue; // the last one of the repeated keys wins
+			}
+			// once a key is after the last one in the DB, all the ones after it are as well
+			if (!appending && mdb_cmp(parent->txn, parent->dbi, &key, &last_key) > 0)
+				appending = true;
+			MDB_val val;
+			val.mv_size = value_size(idx);
+			ret = mdb_cursor_put(cursor.get(), &key, &val, flags::put::reserve | (appending ? flags::put::append : flags::put::none));
+			handle_mdb_error(ret, "failed to put data");
+			write_value(idx, (char*)val.mv_data);
+		}
+	}
+
+	// same as above but get_value(idx) should return the Value for keys[idx]
+	template<typename F>
+	void put_many(tcb::span<const Key> keys, F&& get_value) {
+		using namespace impl;
+		put_many_serialized(keys, [&](std::size_t idx) {
+			return get_val_size(get_value(idx));
+		}, [&](std::size_t idx, char* dst) {
+			const Value& v = get_value(idx);
+			std::size_t size = get_val_size(v);
+			MDB_val val = to_val<false>(v, dst, (int)size);
+			if (val.mv_data != dst) // views and plain values are not copied by to_val
+				memcpy(dst, val.mv_data, size);
+		});
+	}
 };
 
 template<bool read_only, typename Key, typename Value>
@@ -167,6 +324,30 @@ public:
 		impl::handle_mdb_error(ret, "failed to get next key value pair");
 		return impl::from_val<Key>(key);
 	}
+
+	MDB_stat stat() {
+		MDB_stat stat;
+		int ret = mdb_stat(txn, dbi, &stat);
+		impl::handle_mdb_error(ret, "failed to get db stats");
+		return stat;
+	}
+
+	// the number of key value pairs
+	std::size_t size() {
+		return stat().ms_entries;
+	}
+
+	std::size_t nr_pages() {
+		MDB_stat s = stat();
+		return s.ms_branch_pages + s.ms_leaf_pages + s.ms_overflow_pages;
+	}
+
+	// remove all the key value pairs
+	void clear() {
+		static_assert(!read_only, "can only clear in read/write transactions");
+		int ret = mdb_drop(txn, dbi, 0);
+		impl::handle_mdb_error(ret, "failed to clear db");
+	}
 #if 0
 	iterator key_range(Key min_key) {
 
@@ -193,6 +374,7 @@ private:
 
 public:
 	MDB_txn* get() { return txn.get(); }
+	std::size_t id() { return mdb_txn_id(txn.get()); }
 	mdb_txn() {}
 	mdb_txn(MDB_env* env) : txn { make_txn(env), &mdb_txn_abort } {}
 	void commit() {
@@ -240,22 +422,45 @@ public:
 		impl::handle_mdb_error(ret, "failed to open lmdb env");
 	}
 
-	void set_map_size(std::size_t size) {
-		int ret = mdb_env_set_mapsize(env.get(), size);
-		impl::handle_mdb_error(ret, "failed to set map size");
-	}
-
 	void set_maxdbs(std::size_t nr) {
 		int ret = mdb_env_set_maxdbs(env.get(), (MDB_dbi)nr);
 		impl::handle_mdb_error(ret, "failed to set maxdbs size");
 	}
 
+	MDB_envinfo info() {
+		MDB_envinfo info;
+		int ret = mdb_env_info(env.get(), &info);
+		impl::handle_mdb_error(ret, "failed to get env info");
+		return info;
+	}
+
+	std::size_t get_map_size() {
+		return info().me_mapsize;
+	}
+
+	// note: all the transactions in this process must be closed before the size can be changed
+	void set_map_size(std::size_t size) {
+		int ret = mdb_env_set_mapsize(env.get(), size);
+		impl::handle_mdb_error(ret, "failed to set map size");
+	}
+
 	auto txn_read_write() {
-		return mdb_txn_rw { env.get() };
+		try {
+			return mdb_txn_rw { env.get() };
+		} catch (map_resized_exception&) {
+			set_map_size(0); // adopt the size set by the other process
+			return mdb_txn_rw { env.get() };
+		}
 	}
 	auto txn_read_only() {
 		return mdb_txn_ro { env.get() };
 	}
+
+	// if compact is true then the free pages are omitted and the pages are renumbered
+	void copy(const char* path, bool compact) {
+		int ret = mdb_env_copy2(env.get(), path, compact ? MDB_CP_COMPACT : 0);
+		impl::handle_mdb_error(ret, "failed to copy lmdb env");
+	}
 };
 
 class key_range {
@@ -13,12 +13,33 @@
 
 namespace mdb {
 
+// the map is too small for the changes made in the transaction
+struct map_full_exception : public std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+// another process grew the map beyond its size in this process
+struct map_resized_exception : public std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
+// the DB file is corrupted, or it was written by an incompatible version of lmdb
+struct corrupted_exception : public std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
 namespace impl {
 
 static inline void handle_mdb_error(int err, const char* context) {
 	if (err != 0) {
 		auto msg = fmt::format("{} because: {}", context, mdb_strerror(err));
 		//fmt::print(msg);
+		if (err == MDB_MAP_FULL)
+			throw map_full_exception(msg);
+		if (err == MDB_MAP_RESIZED)
+			throw map_resized_exception(msg);
+		if (err == MDB_CORRUPTED || err == MDB_PAGE_NOTFOUND || err == MDB_INVALID || err == MDB_VERSION_MISMATCH)
+			throw corrupted_exception(msg);
 		throw std::runtime_error(msg);
 	}
 }
@@ -0,0 +1,258 @@
+#include "minimizer.h"
+
+#include <algorithm>
+
+namespace cppm {
+
+namespace {
+
+bool is_ident_char(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		c == '_' || c == '$' || (unsigned char)c >= 0x80;
+}
+
+bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+bool is_horizontal_space(char c) {
+	return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r';
+}
+
+bool is_raw_string_prefix(std::string_view s) {
+	return s == "R" || s == "u8R" || s == "uR" || s == "UR" || s == "LR";
+}
+
+// the tokens after which <...> is a header name rather than a less-than
+bool is_header_name_context(std::string_view s) {
+	return s == "include" || s == "include_next" || s == "import" ||
+		s == "__has_include" || s == "__has_include_next";
+}
+
+struct minimizer {
+	std::string_view src;
+	std::string& out;
+	std::size_t pos = 0;
+	bool copy = false; // if false then the input is only skipped
+
+	enum class until { end_of_line, semicolon };
+
+	char peek(std::size_t ofs = 0) const {
+		return (pos + ofs < src.size()) ? src[pos + ofs] : '\0';
+	}
+
+	void emit(char c) {
+		if (copy) out += c;
+	}
+
+	void emit(std::string_view s) {
+		if (copy) out += s;
+	}
+
+	// a backslash at the end of a line splices it with the next one
+	bool skip_line_continuation() {
+		if (peek() != '\\')
+			return false;
+		std::size_t ofs = 1;
+		while (is_horizontal_space(peek(ofs))) // clang allows this with a warning
+			++ofs;
+		if (peek(ofs) != '\n')
+			return false;
+		pos += ofs + 1;
+		return true;
+	}
+
+	void skip_line_comment() {
+		while (pos < src.size() && peek() != '\n')
+			if (!skip_line_continuation())
+				++pos;
+	}
+
+	void skip_block_comment() {
+		pos += 2;
+		while (pos < src.size() && !(peek() == '*' && peek(1) == '/'))
+			++pos;
+		pos = std::min(pos + 2, src.size());
+	}
+
+	void literal() {
+		std::size_t start = pos;
+		char quote = src[pos++];
+		while (pos < src.size()) {
+			char c = peek();
+			if (c == '\\') {
+				pos += 2;
+				continue;
+			}
+			if (c == '\n') // unterminated, e.g an apostrophe in an #error message
+				break;
+			++pos;
+			if (c == quote)
+				break;
+		}
+		pos = std::min(pos, src.size());
+		emit(src.substr(start, pos - start));
+	}
+
+	// e.g R"delim(...)delim" where pos is at the opening quote
+	void raw_string_literal() {
+		std::size_t start = pos;
+		std::size_t delim_start = pos + 1;
+		std::size_t paren = src.find('(', delim_start);
+		if (paren == std::string_view::npos || paren - delim_start > 16) {
+			literal(); // not really a raw string, so just do something reasonable
+			return;
+		}
+		std::string_view delim = src.substr(delim_start, paren - delim_start);
+		pos = src.size();
+		for (std::size_t p = src.find(')', paren + 1); p != std::string_view::npos; p = src.find(')', p + 1)) {
+			std::size_t quote = p + 1 + delim.size();
+			if (quote < src.size() && src[quote] == '"' && src.substr(p + 1, delim.size()) == delim) {
+				pos = quote + 1;
+				break;
+			}
+		}
+		emit(src.substr(start, pos - start));
+	}
+
+	void header_name() {
+		std::size_t start = pos;
+		while (pos < src.size() && peek() != '>' && peek() != '\n')
+			++pos;
+		if (peek() == '>')
+			++pos;
+		emit(src.substr(start, pos - start));
+	}
+
+	// an identifier or a pp-number (which may contain digit separators)
+	std::string_view token() {
+		std::size_t start = pos;
+		bool number = !is_ident_char(peek()) || is_digit(peek());
+		while (pos < src.size()) {
+			char c = peek();
+			if (is_ident_char(c) || (number && c == '.'))
+				++pos;
+			else if (number && c == '\'' && is_ident_char(peek(1)))
+				++pos;
+			else if (number && (c == '+' || c == '-') && std::string_view { "eEpP" }.find(src[pos - 1]) != std::string_view::npos)
+				++pos;
+			else
+				break;
+		}
+		auto tok = src.substr(start, pos - start);
+		emit(tok);
+		if (peek() == '"' && is_raw_string_prefix(tok))
+			raw_string_literal();
+		return tok;
+	}
+
+	// copy (or skip) the rest of a logical line, or a module/import declaration up to its semicolon
+	void process(until end) {
+		bool header_name_allowed = false;
+		while (pos < src.size()) {
+			char c = peek();
+			if (c == '\n') {
+				++pos;
+				if (end == until::end_of_line)
+					break;
+				emit(' ');
+			} else if (c == '\r') {
+				++pos;
+			} else if (skip_line_continuation()) {
+			} else if (c == '/' && peek(1) == '/') {
+				skip_line_comment();
+			} else if (c == '/' && peek(1) == '*') {
+				skip_block_comment();
+				emit(' ');
+			} else if (c == '"' || c == '\'') {
+				literal();
+				header_name_allowed = false;
+			} else if (c == '<' && header_name_allowed) {
+				header_name();
+				header_name_allowed = false;
+			} else if (is_ident_char(c) || (c == '.' && is_digit(peek(1)))) {
+				header_name_allowed = is_header_name_context(token());
+			} else {
+				emit(c);
+				++pos;
+				if (!is_horizontal_space(c) && c != '(')
+					header_name_allowed = false;
+				if (c == ';' && end == until::semicolon)
+					break;
+			}
+		}
+		emit('\n');
+	}
+
+	// whitespace and comments before the first token on a line
+	void skip_leading_space() {
+		while (pos < src.size()) {
+			char c = peek();
+			if (is_horizontal_space(c))
+				++pos;
+			else if (c == '/' && peek(1) == '*')
+				skip_block_comment();
+			else if (!skip_line_continuation())
+				break;
+		}
+	}
+
+	// e.g "import x;", "export import <x>;", "module x;", "export module x;" or "module;"
+	bool at_module_decl() {
+		std::size_t saved_pos = pos;
+		auto word = [&] {
+			std::size_t start = pos;
+			while (pos < src.size() && is_ident_char(peek()))
+				++pos;
+			return src.substr(start, pos - start);
+		};
+		auto spaces = [&] {
+			while (pos < src.size() && is_horizontal_space(peek()))
+				++pos;
+		};
+		auto w = word();
+		if (w == "export") {
+			spaces();
+			w = word();
+		}
+		spaces();
+		char c = peek();
+		// e.g "import :a;" or "module :private;" but not "module::f();" which is a qualified name
+		bool partition = (c == ':' && peek(1) != ':');
+		bool ret = false;
+		if (w == "import")
+			ret = is_ident_char(c) || c == '<' || c == '"' || partition;
+		else if (w == "module")
+			ret = is_ident_char(c) || c == ';' || partition;
+		pos = saved_pos;
+		return ret;
+	}
+
+	void run() {
+		if (src.substr(0, 3) == "\xEF\xBB\xBF") // utf-8 BOM
+			pos = 3;
+		while (pos < src.size()) {
+			skip_leading_space();
+			if (peek() == '#') {
+				copy = true;
+				process(until::end_of_line);
+			} else if (at_module_decl()) {
+				copy = true;
+				process(until::semicolon);
+				copy = false;
+				process(until::end_of_line);
+			} else {
+				copy = false;
+				process(until::end_of_line);
+			}
+		}
+	}
+};
+
+} // namespace
+
+void minimize_source(std::string_view src, std::string& out) {
+	minimizer { src, out }.run();
+}
+
+} // namespace cppm
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace cppm {
+
+// reduce a source file to only what's needed to find its dependencies:
+// the preprocessor directives and the module/import declarations, without comments
+// (similar to what clang-scan-deps does internally for each file it reads)
+// note: the result is appended to out
+void minimize_source(std::string_view src, std::string& out);
+
+} // namespace cppm
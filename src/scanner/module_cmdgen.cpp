@@ -2,6 +2,7 @@
 
 #include "cmd_line_utils.h"
 
+#include <algorithm>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -25,10 +26,28 @@ ModuleCommandGenerator::ModuleCommandGenerator(ScanItemSetView item_set, ModuleV
 	cmd_buf.reserve(16 * 1024);
 }
 
-void ModuleCommandGenerator::generate(scan_item_idx_t idx, Format format,
-	std::function<std::string_view(scan_item_idx_t)> bmi_file_func)
+void ModuleCommandGenerator::generate(scan_item_idx_t idx, Format format, bmi_file_func_t bmi_file_func)
 {
 	cmd_buf.clear();
+	generate_to(cmd_buf, idx, format, bmi_file_func);
+}
+
+ModuleCommandGenerator::AllFlags ModuleCommandGenerator::generate_all(Format format, bmi_file_func_t bmi_file_func)
+{
+	AllFlags ret;
+	ret.ends.resize(item_set.items.size());
+	for (auto idx : item_set.items.indices()) {
+		generate_to(ret.arena, idx, format, bmi_file_func);
+		ret.ends[idx] = ret.arena.size();
+	}
+	return ret;
+}
+
+void ModuleCommandGenerator::generate_to(fmt::memory_buffer& buf, scan_item_idx_t idx, Format format,
+	bmi_file_func_t bmi_file_func)
+{
+	std::size_t start = buf.size();
+	references_end = 0;
 
 	bool is_header_unit = item_set.items[idx].is_header_unit;
 	bool has_export = (!module_visitor.exports[idx].empty());
@@ -40,18 +59,22 @@ void ModuleCommandGenerator::generate(scan_item_idx_t idx, Format format,
 
 	if (format.isMSVC()) {
 		auto cmd_idx = item_set.items[idx].command_idx;
-		std::string ifcdir = get_ifc_path(item_set.commands[cmd_idx]); // todo: this is slow
-		fmt::format_to(cmd_buf, " /experimental:module /module:stdIfcDir \"{}\"",
-			ifcdir);
+		if (cmd_flags_cache.size() != item_set.commands.size())
+			cmd_flags_cache.resize(item_set.commands.size());
+		auto& cmd_flags = cmd_flags_cache[cmd_idx];
+		if (!cmd_flags) // getting the ifc path is slow, but most items share a few commands
+			cmd_flags = fmt::format(" /experimental:module /module:stdIfcDir \"{}\"",
+				get_ifc_path(item_set.commands[cmd_idx]));
+		buf.append(cmd_flags->data(), cmd_flags->data() + cmd_flags->size());
 
 		if (has_export)
-			fmt::format_to(cmd_buf, " /module:interface /module:output \"{}\"", bmi_file_func(idx));
+			fmt::format_to(buf, " /module:interface /module:output \"{}\"", bmi_file_func(idx));
 
 		if (is_header_unit)
-			fmt::format_to(cmd_buf, " /module:export /module:name fixme /module:output \"{}\"", bmi_file_func(idx));
+			fmt::format_to(buf, " /module:export /module:name fixme /module:output \"{}\"", bmi_file_func(idx));
 
-		module_visitor.visit_transitive_imports(idx, [&](scan_item_idx_t imp_idx) {
-			fmt::format_to(cmd_buf, " /module:reference \"{}\"", bmi_file_func(imp_idx));
+		module_visitor.visit_transitive_imports(visit_state, idx, [&](scan_item_idx_t imp_idx) {
+			fmt::format_to(buf, " /module:reference \"{}\"", bmi_file_func(imp_idx));
 		});
 
 		// todo: header unit flags ?
@@ -60,31 +83,66 @@ void ModuleCommandGenerator::generate(scan_item_idx_t idx, Format format,
 			if(format.isClangCl())
 				// clang-cl doesn't support gcc compatible driver flags, it needs CC1 flags
 				// todo: there doesn't seem to be a CC1 equivalent of -fno-implicit-module-maps ?
-				fmt::format_to(cmd_buf, " -Xclang -fno-implicit-modules");
+				fmt::format_to(buf, " -Xclang -fno-implicit-modules");
 			else
-				fmt::format_to(cmd_buf, " -fno-implicit-modules -fno-implicit-module-maps");
-
-		module_visitor.visit_transitive_imports(idx, [&](scan_item_idx_t imp_idx) {
-			if(!module_visitor.exports[imp_idx].empty())
-				fmt::format_to(cmd_buf, " -Xclang -fmodule-file={}=\"{}\"", 
-					module_visitor.exports[imp_idx], bmi_file_func(imp_idx));
-			else // for header units
-				fmt::format_to(cmd_buf, " -Xclang -fmodule-file=\"{}\"",
+				fmt::format_to(buf, " -fno-implicit-modules -fno-implicit-module-maps");
+
+		// with the prebuilt module paths clang can find the named modules that are only imported indirectly on its own
+		// so then only the direct imports are referenced, but the header units can't be found by name
+		bool only_direct_imports = (has_import && !clang_prebuilt_module_paths.empty());
+		if (only_direct_imports && prebuilt_path_added_by.size() != clang_prebuilt_module_paths.size())
+			prebuilt_path_added_by.resize(clang_prebuilt_module_paths.size());
+		prebuilt_path_generation++;
+
+		module_visitor.visit_transitive_imports(visit_state, idx, [&](scan_item_idx_t imp_idx) {
+			if (module_visitor.exports[imp_idx].empty()) { // for header units
+				fmt::format_to(buf, " -Xclang -fmodule-file=\"{}\"",
 					bmi_file_func(imp_idx));
+			} else if (!only_direct_imports) {
+				fmt::format_to(buf, " -Xclang -fmodule-file={}=\"{}\"",
+					module_visitor.exports[imp_idx], bmi_file_func(imp_idx));
+			} else {
+				auto target_idx = item_set.items[imp_idx].target_idx;
+				auto& added_by = prebuilt_path_added_by[target_idx];
+				if (added_by != prebuilt_path_generation) {
+					added_by = prebuilt_path_generation;
+					fmt::format_to(buf, " -Xclang -fprebuilt-module-path=\"{}\"", clang_prebuilt_module_paths[target_idx]);
+				}
+			}
 		});
 
-		references_end = cmd_buf.size();
+		if (only_direct_imports)
+			for (auto imp_idx : module_visitor.imports_item[idx])
+				if (!module_visitor.exports[imp_idx].empty())
+					fmt::format_to(buf, " -Xclang -fmodule-file={}=\"{}\"",
+						module_visitor.exports[imp_idx], bmi_file_func(imp_idx));
+
+		references_end = buf.size() - start;
 
+		// the driver writes the BMI next to the object, at the path that the importers reference
+		// note: the driver only compiles the sources with a module interface extension (e.g .cppm) as module units,
+		// the others need a -x c++-module before the source in the command
 		if (has_export)
-			fmt::format_to(cmd_buf, " -Xclang -emit-module-interface");
+			fmt::format_to(buf, format.isClangCl() ? " /clang:-fmodule-output=\"{}\"" : " -fmodule-output=\"{}\"",
+				bmi_file_func(idx));
 
 		if (is_header_unit) {
 			std::size_t hash = std::hash<std::string_view> {} (item_set.items[idx].path);
 			// todo: fix the compiler so we don't need -fmodule-name or -I.
-			fmt::format_to(cmd_buf, " -Xclang -emit-header-module -Xclang -fmodule-name=hu_{} -I.", hash);
+			fmt::format_to(buf, " -Xclang -emit-header-module -Xclang -fmodule-name=hu_{} -I.", hash);
 		}
+	} else if (format.isGCC()) {
+		// GCC asks the mapper where the BMIs of the imports are when it needs them
+		// so unlike for the other compilers there are no references to add here
+		fmt::format_to(buf, " -fmodules-ts");
+		if (!gcc_module_mapper.empty())
+			fmt::format_to(buf, " \"-fmodule-mapper={}\"", gcc_module_mapper);
+
+		references_end = buf.size() - start;
+
+		if (is_header_unit)
+			fmt::format_to(buf, " -fmodule-header");
 	}
-	// todo: gcc
 }
 
 void ModuleCommandGenerator::full_cmd_to_string(std::string& str)
@@ -117,6 +175,14 @@ std::string ModuleCommandGenerator::references_to_string()
 	return references;
 }
 
+std::string ModuleCommandGenerator::prebuilt_bmi_file(std::string_view prebuilt_module_path, std::string_view module_name)
+{
+	// clang looks for the partitions (e.g a:b) as a-b.pcm
+	std::string file_name = (std::string)module_name;
+	std::replace(file_name.begin(), file_name.end(), ':', '-');
+	return fmt::format("{}/{}.pcm", prebuilt_module_path, file_name);
+}
+
 ModuleCommandGenerator::Format ModuleCommandGenerator::detect_format(std::string_view cmd) {
 	// todo:
 	if (cmd.find("clang-cl.exe") != std::string_view::npos)
@@ -1,9 +1,10 @@
 #pragma once
 
 #include "scanner.h"
+#include "function_ref.h"
 
 #include <string>
-#include <functional>
+#include <optional>
 #pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
 #include "fmt/format.h"
 
@@ -14,7 +15,20 @@ struct ModuleCommandGenerator
 	fmt::memory_buffer cmd_buf;
 	ScanItemSetView item_set;
 	ModuleVisitor& module_visitor;
+	// so that a generator can be used on each thread with the same module_visitor
+	ModuleVisitor::visit_state visit_state;
+	// relative to the start of the last generated item's flags
 	std::size_t references_end = 0;
+	// for the Clang formats: if set then the BMIs of the named modules of each target must be in its directory here
+	// with the names from prebuilt_bmi_file, and then only the direct imports are referenced on the command line
+	vector_map<target_idx_t, std::string> clang_prebuilt_module_paths;
+	// the generation that last added each target's prebuilt module path, so that each path is only added once per item
+	vector_map<target_idx_t, std::size_t> prebuilt_path_added_by;
+	std::size_t prebuilt_path_generation = 0;
+	// for the GCC format: the -fmodule-mapper to use, e.g from GccModuleMapper::mapper_spec
+	std::string gcc_module_mapper;
+	// the flags that only depend on the command, e.g the MSVC stdIfcDir
+	vector_map<cmd_idx_t, std::optional<std::string>> cmd_flags_cache;
 
 	enum FormatEnum {
 		Unknown,
@@ -42,13 +56,34 @@ struct ModuleCommandGenerator
 
 	static Format detect_format(std::string_view cmd);
 
+	// where clang looks for a module's BMI in a prebuilt module path
+	static std::string prebuilt_bmi_file(std::string_view prebuilt_module_path, std::string_view module_name);
+
 	ModuleCommandGenerator(ScanItemSetView item_set, ModuleVisitor& module_visitor);
 
 	std::string get_bmi_file(std::string_view output_file);
 
-	// todo: use function_ref
-	void generate(scan_item_idx_t idx, Format format,
-		std::function<std::string_view(scan_item_idx_t)> bmi_file_func);
+	using bmi_file_func_t = function_ref<std::string_view(scan_item_idx_t)>;
+
+	// generates the flags of an item into cmd_buf
+	void generate(scan_item_idx_t idx, Format format, bmi_file_func_t bmi_file_func);
+
+	// appends the flags of an item to buf
+	void generate_to(fmt::memory_buffer& buf, scan_item_idx_t idx, Format format, bmi_file_func_t bmi_file_func);
+
+	// the flags of all of the items in one buffer
+	struct AllFlags {
+		fmt::memory_buffer arena;
+		// the flags of item idx are at [ends[idx - 1], ends[idx]) in the arena
+		vector_map<scan_item_idx_t, std::size_t> ends;
+
+		std::string_view operator[](scan_item_idx_t idx) const {
+			std::size_t begin = (idx == scan_item_idx_t { 0 }) ? 0 : ends[scan_item_idx_t { (std::size_t)idx - 1 }];
+			return { arena.data() + begin, ends[idx] - begin };
+		}
+	};
+
+	AllFlags generate_all(Format format, bmi_file_func_t bmi_file_func);
 	
 	void full_cmd_to_string(std::string& str);
 	std::string full_cmd_to_string();
@@ -184,8 +184,9 @@ public:
 	void visit(SpanVisitor&& visitor) {
 		can_add = false;
 		if (buf.empty()) {
-			for (size_type i = {}; i != size(); ++i)
-				visitor(i, {});
+			// only visit the vectors that were added, the other indices may belong to someone else
+			for (auto& vec : vecs)
+				visitor(vec.final_idx, {});
 			return;
 		}
 		T* start = &buf.front();
@@ -217,6 +218,16 @@ public:
 		});
 	}
 
+	// unlike get_last_span this still allows adding more elements later
+	// note: the returned span is only valid until the next call to add
+	auto peek_last_span() {
+		if (buf.empty() || vecs.empty())
+			return tcb::span<T> {};
+		T* start = &buf.front() + vecs.back().ofs;
+		T* end = &buf.front() + buf.size();
+		return tcb::span<T> { start, end };
+	}
+
 	auto get_last_span() {
 		can_add = false;
 		if (buf.empty() || vecs.empty())
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace cppm {
+
+// launch f on a new thread right away
+// (std::async with the default policy is allowed to defer it until get() is called)
+template<typename F>
+auto eager_future(F&& f) {
+	return std::async(std::launch::async, std::forward<F>(f));
+}
+
+inline std::size_t default_nr_threads() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// split [begin, end) into contiguous chunks and call f(idx) for each index,
+// using the current thread for the first chunk and new threads for the rest
+// note: exceptions thrown by f are rethrown here, after all of the threads finished
+template<typename idx_t, typename F>
+void parallel_for(idx_t begin, idx_t end, F&& f, std::size_t min_chunk_size = 256,
+	std::size_t max_nr_threads = default_nr_threads())
+{
+	std::size_t size = (std::size_t)end - (std::size_t)begin;
+	if (size == 0)
+		return;
+	std::size_t nr_chunks = std::min(max_nr_threads, (size + min_chunk_size - 1) / min_chunk_size);
+	nr_chunks = std::max(nr_chunks, std::size_t { 1 });
+	std::size_t chunk_size = (size + nr_chunks - 1) / nr_chunks;
+
+	auto run_chunk = [&](std::size_t chunk_idx) {
+		std::size_t s = (std::size_t)begin + chunk_idx * chunk_size;
+		std::size_t e = std::min(s + chunk_size, (std::size_t)end);
+		for (std::size_t i = s; i < e; ++i)
+			f(idx_t { i });
+	};
+
+	std::vector<std::future<void>> futures;
+	futures.reserve(nr_chunks - 1);
+	for (std::size_t chunk_idx = 1; chunk_idx < nr_chunks; ++chunk_idx)
+		futures.push_back(eager_future([&, chunk_idx] { run_chunk(chunk_idx); }));
+	std::exception_ptr first_exception;
+	try {
+		run_chunk(0);
+	} catch (...) {
+		first_exception = std::current_exception();
+	}
+	for (auto& future : futures) {
+		try {
+			future.get();
+		} catch (...) {
+			if (!first_exception)
+				first_exception = std::current_exception();
+		}
+	}
+	if (first_exception)
+		std::rethrow_exception(first_exception);
+}
+
+} // namespace cppm
@@ -9,337 +9,39 @@
 #include <unordered_map>
 #include <optional>
 #include <charconv>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include <nlohmann/json.hpp>
 
-#include "lmdb_wrapper.h"
-#include "lmdb_path_store.h"
-#include "lmdb_store.h"
-#include "lmdb_string_store.h"
+#include "scanner_db.h"
 #include "strong_id.h"
 #include "multi_buffer.h"
 #include "trace.h"
 #include "cmd_line_utils.h"
 #include "file_time.h"
-
-namespace cppm {
-
-DECL_STRONG_ID_INV(file_id_t, 0); // 0 is the invalid file id
-DECL_STRONG_ID(unique_deps_idx_t);
-DECL_STRONG_ID(to_stat_idx_t);
-DECL_STRONG_ID_INV(db_target_id, 0);
-DECL_STRONG_ID_INV(module_id_t, 0);
-
-using cmd_hash_t = std::size_t; // todo: probably needs a bigger hash to avoid collisions ? 
-struct item_id_t {
-	file_id_t file_id;
-	db_target_id target_id;
-	bool operator==(const item_id_t& other) const noexcept { // for unordered_map
-		return file_id == other.file_id && target_id == other.target_id;
-	}
-	friend std::ostream& operator <<(std::ostream& os, const item_id_t& i) {
-		os << "(" << i.file_id << "," << i.target_id << ")";
-		return os;
-	}
-};
-
-}
-
-namespace std {
-    // todo: get this to work for all strong ids
-	template <>
-	struct hash<cppm::item_id_t> {
-		std::size_t operator()(const cppm::item_id_t& x) const {
-			static_assert(sizeof(cppm::item_id_t) == sizeof(uint64_t), "size mismatch");
-			return std::hash<uint64_t>{}(*reinterpret_cast<const uint64_t*>(&x));
-		}
-	};
-}
+#include "parallel.h"
+#include "minimizer.h"
+#include "module_cmdgen.h"
 
 namespace cppm {
 
 namespace fs = std::filesystem;
 
-std::string concat_u8_path(std::string_view path, std::string_view filename) {
-	return (fs::u8path(path) / filename).string();
-}
-
-struct DB {
-	mdb::mdb_env env;
-	mdb::mdb_txn_rw txn_rw;
-
-	void open(std::string_view db_path, std::string_view db_file_name) {
-		TRACE();
-		using namespace mdb::flags;
-		constexpr int MB = 1024 * 1024;
-#ifdef _WIN32
-		env.set_map_size(16 * MB);
-#else
-		// on linux we could just set an arbitrarily large value here,
-		// as the DB only taskes up as much space as needed anyway
-		env.set_map_size(512 * MB);
-#endif
-		env.set_maxdbs(6);
-		env.open(concat_u8_path(db_path, db_file_name).c_str(), env::nosubdir);
-	}
-
-	struct file_entry {
-		file_time_t last_write_time;
-	};
-
-	mdb::string_id_store<db_target_id> target_store { "targets" };
-	mdb::path_id_store<file_id_t> path_store { "paths" };
-	mdb::id_store<file_id_t, file_entry> file_data_store { "file_data" };
-	mdb::string_id_store<module_id_t> module_store { "modules" };
-
-	auto get_item_file_ids(std::string_view item_root_path, span_map<scan_item_idx_t, const ScanItemView> items)
-	{
-		TRACE();
-		vector_map<scan_item_idx_t, std::string_view> paths;
-		paths.reserve(items.size());
-		for (auto& item : items)
-			paths.push_back(item.path);
-		return path_store.get_file_ids(txn_rw, item_root_path, paths);
-	}
-
-	template<typename size_type, typename... Vs>
-	static void resize_all_to(size_type size, Vs&&... vs) {
-		(vs.resize(size), ...);
-	}
-
-	auto get_target_ids(span_map<target_idx_t, std::string_view> targets) {
-		TRACE();
-		return target_store.get_ids(txn_rw, targets);
-	}
-
-	struct item_entry {
-		cmd_hash_t cmd_hash;
-		file_time_t last_successful_scan;
-		tcb::span<file_id_t> file_deps;
-		tcb::span<item_id_t> item_deps;
-		module_id_t exports;
-		tcb::span<module_id_t> imports;
-	};
-
-	// todo: make the DB independent of particular strong indexes used by the caller   
-	struct item_data {
-		// the source file corresponding to a given item (if it changes, the item is out of date)
-		vector_map<scan_item_idx_t, file_id_t> file_id;
-		vector_map<scan_item_idx_t, cmd_hash_t> cmd_hash;
-		vector_map<scan_item_idx_t, file_time_t> last_successful_scan;
-		// for a given item: if any of the files in file_deps changed then the item is out of date
-		vector_map<scan_item_idx_t, tcb::span<file_id_t>> file_deps;
-		// for a given item: if any of the items in item_deps are out of date then the item is out of date as well
-		// note: this works recursively so that for e.g importable header units we can compress the log more
-		vector_map<scan_item_idx_t, tcb::span<item_id_t>> item_deps;
-		// note: the deps are invalidated on the first mdb_put operation
-		// "Values returned from the database are valid only until a subsequent update operation, or the end of the transaction."
-		file_id_t db_max_file_id = {}; // the largest file id in the database + 1
-		file_id_t max_file_id = {}; // includes new files not already in the database
-		vector_map<scan_item_idx_t, module_id_t> exports;
-		vector_map<scan_item_idx_t, tcb::span<module_id_t>> imports;
-		module_id_t db_max_module_id = {}; // the largest module id the database + 1
-
-		void resize(scan_item_idx_t size) {
-			TRACE();
-			DB::resize_all_to(size, file_id, cmd_hash, last_successful_scan, file_deps, item_deps, exports, imports);
-		}
-	};
-	auto get_item_data(span_map<scan_item_idx_t, const db_target_id> item_target_ids, std::string_view item_root_path,
-		span_map<scan_item_idx_t, const ScanItemView> items) 
-	{
-		item_data data;
-		data.resize(items.size()); // todo: can we not allocate all this if the DB is empty ?
-
-		data.file_id = get_item_file_ids(item_root_path, items);
-		data.db_max_file_id = path_store.db_max_id + 1; // todo: this is terrible
-		data.max_file_id = path_store.next_id;
-
-		TRACE(); // the resize and the get_item_file_ids are measured separately
-		// todo: maybe make file_id the key and allow duplicates >
-		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
-
-		for (auto i : items.indices()) {
-			try {
-				auto file_id = data.file_id[i];
-				if (file_id >= data.db_max_file_id) // nothing to do here for new files
-					continue;
-				auto entry = db.get({ file_id, item_target_ids[i] });
-				// what about data.target ?
-				data.cmd_hash[i] = entry.cmd_hash;
-				data.last_successful_scan[i] = entry.last_successful_scan;
-				data.file_deps[i] = entry.file_deps;
-				data.item_deps[i] = entry.item_deps;
-				data.exports[i] = entry.exports;
-				data.imports[i] = entry.imports;
-			} catch (mdb::key_not_found_exception&) {
-				// if e.g the scanner was interrupted/crashed then
-				// the file may be in the DB but not the item, ignore this
-			}
-		}
-		return data;
-	}
-
-	void update_items(
-		const vector_map<scan_item_idx_t, ood_state>& item_ood,
-		span_map<scan_item_idx_t, const db_target_id> item_target_ids,
-		span_map<scan_item_idx_t, const ScanItemView> items,
-		const vector_map<scan_item_idx_t, file_id_t>& item_file_ids,
-		const vector_map<cmd_idx_t, cmd_hash_t>& cmd_hashes,
-		span_map<scan_item_idx_t, char> got_result,
-		span_map<scan_item_idx_t, tcb::span<file_id_t>> file_deps,
-		span_map<scan_item_idx_t, tcb::span<item_id_t>> item_deps,
-		span_map<scan_item_idx_t, module_id_t> exports,
-		span_map<scan_item_idx_t, tcb::span<module_id_t>> imports)
-	{
-		TRACE();
-		module_store.commit_changes(txn_rw);
-		target_store.commit_changes(txn_rw); // todo: order matters to be able to use append ?
-		path_store.commit_changes(txn_rw);
-
-		auto last_successful_scan = file_time_t_now();
-
-		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
-
-		for (auto i : items.indices()) {
-			if (!got_result[i])
-				continue;
-			if (item_ood[i] == ood_state::up_to_date)
-				continue;
-
-			// if item is new
-			db.put(item_id_t {
-				item_file_ids[i],
-				item_target_ids[i],
-			}, item_entry {
-				cmd_hashes[items[i].command_idx],
-				last_successful_scan,
-				file_deps[i],
-				item_deps[i],
-				exports[i],
-				imports[i]
-			});
-		}
-	}
-
-	void remove_items(span_map<target_idx_t, db_target_id> targets,
-		span_map<scan_item_idx_t, const ScanItemView> items,
-		const vector_map<scan_item_idx_t, file_id_t>& item_file_ids)
-	{
-		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
-
-		for (auto i : items.indices()) {
-			auto file_id = item_file_ids[i];
-			auto target_id = targets[items[i].target_idx];
-			if(target_id.is_valid())
-				db.del(item_id_t { file_id, target_id });
-		}
-	}
-
-	void print_items() {
-		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
-		for (auto&& [item_id, entry] : db) {
-			fmt::print("{} - ", item_id);
-			fmt::print("hash: {} lss: {} exp: {} ",
-				entry.cmd_hash, entry.last_successful_scan, entry.exports);
-			auto print_vec = [](std::string_view name, const auto& vec) {
-				//fmt::print("{}: [{}]", name, fmt::join(vec, ", ")); // todo:
-				if (!vec.empty()) {
-					fmt::print("{}: [{}", name, vec.front());
-					for (auto&& elem : vec.subspan(1))
-						fmt::print(",{}", elem);
-					fmt::print("] ");
-				}
-			};
-			print_vec("imp", entry.imports);
-			print_vec("fdep", entry.file_deps);
-			print_vec("idep", entry.item_deps);
-			fmt::print("\n");
-		}
-	}
-
-	struct file_data {
-		// note: only used when a file tracker is keeping these values up to date
-		vector_map<unique_deps_idx_t, file_time_t> last_write_time;
-		// todo: maybe hash ? - we already need to read all the files to scan them so ..
-		void resize(unique_deps_idx_t size) {
-			DB::resize_all_to(size, last_write_time);
-		}
-	};
-	auto get_file_data(const vector_map<unique_deps_idx_t, file_id_t>& files) {
-		TRACE();
-		file_data data;
-		data.resize(files.size());
-		file_data_store.get_data(txn_rw, files, [&](unique_deps_idx_t idx, const file_entry& f) {
-			data.last_write_time[idx] = f.last_write_time;
-		});
-		return data;
-	}
-
-	void get_file_paths(std::string_view item_root_path,
-		tcb::span<const file_id_t> deps_to_stat, 
-		/*inout:*/ vector_map<file_id_t, std::string_view>& file_paths)
-	{
-		// todo: parallelize this ?
-		for (auto dep_file_id : deps_to_stat) {
-			if (file_paths[dep_file_id].empty()) // don't use the DB if it's already set
-				file_paths[dep_file_id] = path_store.get_file_path(dep_file_id);
-		}
-	}
-
-	auto get_all_module_names() {
-		return module_store.get_all_strings(txn_rw);
-	}
-
-	struct db_header {
-		constexpr static int current_version = 3;
-		int version = current_version;
-	};
-
-	void read_write_transaction() {
-		TRACE();
-		txn_rw = env.txn_read_write();
-
-		auto dbi = txn_rw.open_db<uint64_t, db_header>("header");
-		db_header h;
-		try {
-			h = dbi.get(1);
-		} catch (mdb::key_not_found_exception&) {
-			dbi.put(1, db_header {});
-		}
-		if (h.version != db_header::current_version)
-			throw std::runtime_error("db version mismatch");
-	}
-
-	void commit_transaction() {
-		TRACE();
-		// todo: this is slow, maybe use MDB_MAPASYNC ?
-		txn_rw.commit();
-	}
-
-	// this needs to be called before using try_add_* or get_*
-	void init_stores() {
-		TRACE();
-		module_store.init(txn_rw, {});
-	}
-
-	// note: the input string must be valid until the changes are committed later
-	module_id_t try_add_module(std::string_view name) {
-		return module_store.try_add(name);
-	}
-
-	// note: path_store always make a normalized local copy of path
-	file_id_t try_add_file(std::string_view path) {
-		return path_store.try_add(path);
-	}
-
-	std::string_view get_module_name(module_id_t id) {
-		return module_store.get(id);
-	}
-};
-
 struct ScannerImpl {
 	DB db;
+	// the up to date items are submitted to the observer while the scanner is running
+	// so this makes sure that the results for one item are not interleaved with another
+	std::mutex observer_mutex;
+	// reset at the start of each scan
+	ScanStats stats;
+	// the ids of the items in the last scan, for put_fingerprints
+	vector_map<scan_item_idx_t, item_id_t> scanned_item_ids;
+	// the DB is closed after it's compacted by the gc
+	bool db_closed = false;
+	// the gc renumbers the paths, so then the path store has to be read again for get_file_ids
+	bool paths_stale = false;
 
 	ScannerImpl() {
 		// todo: launch threads early, hoping to hide some of the startup overhead ?
@@ -375,7 +77,12 @@ struct ScannerImpl {
 	{
 		TRACE();
 		// todo: maybe store the unique deps for each target ?
-		vector_map<unique_deps_idx_t, file_id_t> unique_deps;
+		struct ret_t {
+			vector_map<unique_deps_idx_t, file_id_t> unique_deps;
+			// the item files come first in unique_deps, followed by the other deps
+			unique_deps_idx_t nr_item_files = {};
+		} ret;
+		auto& unique_deps = ret.unique_deps;
 		unique_deps.reserve(id_cast<unique_deps_idx_t>(max_file_id));
 		vector_map<file_id_t, char> file_visited;
 		file_visited.resize(max_file_id);
@@ -388,13 +95,14 @@ struct ScannerImpl {
 
 		for (auto file_id : all_item_file_ids)
 			add(file_id);
+		ret.nr_item_files = unique_deps.size();
 
 		for (auto file_deps : all_file_deps)
 			for (auto file_id : file_deps)
 				add(file_id);
 
 		// note: item_deps doesn't add any unique file deps not already added here
-		return unique_deps;
+		return ret;
 	}
 
 	auto get_file_paths(std::string_view item_root_path,
@@ -417,7 +125,33 @@ struct ScannerImpl {
 		return file_paths;
 	}
 
+	static uint64_t get_elapsed_us(std::chrono::steady_clock::time_point start) {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the items' own files don't need to be looked up in the DB
+	// so they can be stat-ed while the DB is being read
+	// note: this runs concurrently with the DB reads, so it must only touch the stat fields of stats
+	auto get_item_last_write_times(std::string_view item_root_path,
+		span_map<scan_item_idx_t, const ScanItemView> items)
+	{
+		TRACE();
+		auto start = std::chrono::steady_clock::now();
+		vector_map<scan_item_idx_t, file_time_t> item_lwts;
+		item_lwts.resize(items.size());
+		parallel_for(scan_item_idx_t { 0 }, items.size(), [&](scan_item_idx_t i) {
+			item_lwts[i] = get_last_write_time(get_rooted_path(item_root_path, items[i].path));
+		});
+		TRACE_COUNTER("items stated", (std::size_t)items.size());
+		stats.files_stated += (std::size_t)items.size();
+		stats.stat_time_us += get_elapsed_us(start);
+		return item_lwts;
+	}
+
 	auto remove_deps_already_stated(vector_map<unique_deps_idx_t, file_id_t>& unique_deps,
+		unique_deps_idx_t nr_item_files, span_map<scan_item_idx_t, const file_id_t> item_file_ids,
+		const vector_map<scan_item_idx_t, file_time_t>& item_lwts,
 		bool file_tracker_running, file_id_t max_file_id)
 	{
 		TRACE();
@@ -431,7 +165,13 @@ struct ScannerImpl {
 			for (auto idx : unique_deps.indices())
 				ret.real_lwts[unique_deps[idx]] = file_data.last_write_time[idx];
 		} else {
-			ret.deps_to_stat = { unique_deps.data(), std::size_t(unique_deps.size()) }; // todo: should use id_cast<to_stat_idx_t>
+			// the items were already stat-ed by get_item_last_write_times
+			for (auto idx : item_file_ids.indices())
+				ret.real_lwts[item_file_ids[idx]] = item_lwts[idx];
+			auto first_dep = unique_deps.data() + (std::size_t)nr_item_files;
+			// note: assigned as a span, span_map's implicit copy assignment is deprecated
+			ret.deps_to_stat = tcb::span<file_id_t> { first_dep,
+				(std::size_t)unique_deps.size() - (std::size_t)nr_item_files };
 		}
 		return ret;
 	}
@@ -450,13 +190,17 @@ struct ScannerImpl {
 		//fs::current_path(fs::u8path(item_root_path));
 		// todo: we need a huge # of threads for get_last_write_time, but maybe that's
 		// unnecessary thread launch overhead if ~all of the files have been stat-ed already in the current build
-//#pragma omp parallel for
-		for (auto i = to_stat_idx_t { 0 }; i < deps_to_stat.size(); ++i) {
+		// note: each dep_id is unique so the threads write to different elements
+		auto start = std::chrono::steady_clock::now();
+		parallel_for(to_stat_idx_t { 0 }, deps_to_stat.size(), [&](to_stat_idx_t i) {
 			file_id_t dep_id = deps_to_stat[i];
 			real_last_write_time[dep_id] = get_last_write_time(
 				get_rooted_path(item_root_path, file_paths[dep_id])
 			);
-		}
+		});
+		TRACE_COUNTER("files stated", (std::size_t)deps_to_stat.size());
+		stats.files_stated += (std::size_t)deps_to_stat.size();
+		stats.stat_time_us += get_elapsed_us(start);
 	}
 
 	auto get_cmd_hashes(span_map<cmd_idx_t, std::string_view> commands)
@@ -629,7 +373,8 @@ struct ScannerImpl {
 		std::string_view item_root_path,
 		span_map<scan_item_idx_t, const ScanItemView> items,
 		const std::vector<scan_item_idx_t>& ood_items,
-		const fs::path& comp_db_path)
+		const fs::path& comp_db_path,
+		std::string_view vfs_overlay_path = {})
 	{
 		if (ood_items.empty())
 			return;
@@ -649,6 +394,14 @@ struct ScannerImpl {
 			std::string cmd = (std::string)commands[items[i].command_idx];
 			//cmd += " -v ";
 			if (!commands_contain_item_path) cmd += fmt::format(" \"{}\"", path);
+			if (!vfs_overlay_path.empty()) {
+				// clang-scan-deps runs the cl.exe and clang-cl commands in clang-cl's driver mode which doesn't have -ivfsoverlay
+				auto format = ModuleCommandGenerator::detect_format(cmd);
+				if (format.isMSVC() || format.isClangCl())
+					cmd += fmt::format(" -Xclang -ivfsoverlay -Xclang \"{}\"", vfs_overlay_path);
+				else
+					cmd += fmt::format(" -ivfsoverlay \"{}\"", vfs_overlay_path);
+			}
 			json["command"] = std::move(cmd);
 			json_array.push_back(json);
 		}
@@ -699,16 +452,247 @@ struct ScannerImpl {
 		return header_unit_lookup;
 	}
 
+	// the minimized sources are materialized in int_dir, named after the write time of the original,
+	// so that a copy made for a previous version of the file is never used by mistake
+	std::string get_minimized_file_path(std::string_view int_dir, file_id_t file_id, file_time_t last_write_time) {
+		return concat_u8_path(int_dir, fmt::format("minimized/{}-{}", file_id, last_write_time));
+	}
+
+	// write a VFS overlay that makes clang-scan-deps read the minimized sources from the DB
+	// instead of the original files, for the deps of the items that are about to be rescanned
+	// returns the path to the overlay or "" if nothing can be used from the DB
+	std::string use_minimized_sources(std::string_view int_dir,
+		const std::vector<scan_item_idx_t>& ood_items, const DB::item_data& item_data,
+		span_map<file_id_t, const file_time_t> real_lwt,
+		/*out:*/ vector_map<file_id_t, char>& minimized_hit)
+	{
+		TRACE();
+		minimized_hit.resize(item_data.max_file_id);
+		std::vector<file_id_t> deps;
+		for (auto i : ood_items) {
+			for (auto dep_id : item_data.file_deps[i]) {
+				if (!minimized_hit[dep_id]) {
+					minimized_hit[dep_id] = true; // just marks it as visited for now
+					deps.push_back(dep_id);
+				}
+			}
+		}
+		for (auto dep_id : deps)
+			minimized_hit[dep_id] = false;
+		if (deps.empty())
+			return {};
+
+		fs::create_directories(fs::u8path(int_dir) / "minimized");
+		// note: files with the same parent directory must be grouped together in the overlay
+		std::unordered_map<std::string, nlohmann::json> dirs;
+		db.get_minimized_sources(deps, [&](std::size_t idx, const DB::minimized_entry& entry) {
+			auto dep_id = deps[idx];
+			if (entry.last_write_time != real_lwt[dep_id]) // the file changed since it was minimized
+				return;
+			auto min_path = get_minimized_file_path(int_dir, dep_id, entry.last_write_time);
+			if (!fs::exists(min_path)) { // e.g a different int_dir than when it was minimized
+				std::ofstream fout(min_path, std::ios::binary);
+				fout.write(entry.contents.data(), entry.contents.size());
+				if (!fout)
+					return;
+			}
+			auto path = fs::u8path(db.path_store.get_file_path(dep_id));
+			dirs[path.parent_path().string()].push_back({
+				{ "type", "file" },
+				{ "name", path.filename().string() },
+				{ "external-contents", fs::absolute(min_path).string() }
+			});
+			minimized_hit[dep_id] = true;
+		});
+		if (dirs.empty())
+			return {};
+
+		auto roots = nlohmann::json::array();
+		for (auto& [dir, contents] : dirs)
+			roots.push_back({ { "type", "directory" }, { "name", dir }, { "contents", std::move(contents) } });
+		nlohmann::json overlay = {
+			{ "version", 0 },
+			// the dependencies should still be reported with the original paths
+			{ "use-external-names", false },
+#ifdef _WIN32
+			{ "case-sensitive", false },
+#endif
+			{ "roots", std::move(roots) }
+		};
+		auto overlay_path = concat_u8_path(int_dir, "minimized_overlay.yaml"); // yaml is a superset of json
+		std::ofstream fout(overlay_path);
+		if (!fout)
+			throw std::runtime_error("failed to open the VFS overlay for the minimized sources");
+		fout << overlay.dump();
+		return overlay_path;
+	}
+
+	// minimize the deps of the rescanned items that weren't already used from the DB, for next time
+	// the minimized sources to put in the DB with the other changes
+	struct minimized_sources {
+		std::vector<file_id_t> files;
+		std::vector<file_time_t> lwts;
+		std::vector<std::string> minimized;
+		std::vector<char> changed;
+
+		void put(DB& db) {
+			db.put_minimized_sources(files, [&](std::size_t idx) -> std::optional<DB::minimized_entry> {
+				if (!changed[idx])
+					return std::nullopt;
+				return DB::minimized_entry { lwts[idx], minimized[idx] };
+			});
+		}
+	};
+
+	auto minimize_sources(std::string_view int_dir,
+		const std::vector<scan_item_idx_t>& ood_items, span_map<scan_item_idx_t, const char> got_result,
+		span_map<scan_item_idx_t, const tcb::span<file_id_t>> file_deps,
+		const vector_map<file_id_t, char>& minimized_hit)
+	{
+		TRACE();
+		minimized_sources ret;
+		vector_map<file_id_t, char> visited;
+		visited.resize(db.path_store.next_id);
+		std::vector<file_id_t>& misses = ret.files;
+		for (auto i : ood_items) {
+			if (!got_result[i])
+				continue;
+			for (auto dep_id : file_deps[i]) {
+				if (visited[dep_id] || (dep_id < minimized_hit.size() && minimized_hit[dep_id]))
+					continue;
+				visited[dep_id] = true;
+				misses.push_back(dep_id);
+			}
+		}
+		if (misses.empty())
+			return ret;
+
+		// the write time is read before the contents, so if the file changes
+		// in between then the entry will just be out of date next time
+		std::vector<file_time_t>& lwts = ret.lwts;
+		lwts.resize(misses.size());
+		parallel_for(std::size_t { 0 }, misses.size(), [&](std::size_t idx) {
+			lwts[idx] = get_last_write_time(fs::u8path(db.path_store.get_file_path(misses[idx])));
+		});
+		// e.g another item already minimized the same version of the file
+		std::vector<file_time_t> db_lwts(misses.size(), std::numeric_limits<file_time_t>::max());
+		db.get_minimized_sources(misses, [&](std::size_t idx, const DB::minimized_entry& entry) {
+			db_lwts[idx] = entry.last_write_time;
+		});
+
+		std::vector<std::string>& minimized = ret.minimized;
+		std::vector<char>& changed = ret.changed;
+		minimized.resize(misses.size());
+		changed.resize(misses.size());
+		fs::create_directories(fs::u8path(int_dir) / "minimized");
+		parallel_for(std::size_t { 0 }, misses.size(), [&](std::size_t idx) {
+			if (lwts[idx] == db_lwts[idx] || lwts[idx] == std::numeric_limits<file_time_t>::max())
+				return;
+			std::ifstream fin(fs::u8path(db.path_store.get_file_path(misses[idx])), std::ios::binary);
+			if (!fin.is_open()) // e.g it was removed since it was stat-ed, then it's just not cached
+				return;
+			std::string src { std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>() };
+			if (fin.bad())
+				return;
+			minimize_source(src, minimized[idx]);
+			auto min_path = get_minimized_file_path(int_dir, misses[idx], lwts[idx]);
+			std::ofstream fout(min_path, std::ios::binary);
+			fout.write(minimized[idx].data(), minimized[idx].size());
+			if (!fout)
+				return;
+			if (db_lwts[idx] != std::numeric_limits<file_time_t>::max()) {
+				std::error_code ec; // it's fine if it was already removed
+				fs::remove(get_minimized_file_path(int_dir, misses[idx], db_lwts[idx]), ec);
+			}
+			changed[idx] = true;
+		}, 16);
+
+		return ret;
+	}
+
+	// runs the scanner tool on another thread and queues up its output,
+	// so that the tool can be started before we're ready to process the results
+	struct scanner_process {
+		// the queued lines point into this, so it must outlive the DB changes using them
+		stable_multi_string_buffer read_lines;
+		std::mutex queue_mutex;
+		std::condition_variable queue_cv;
+		std::vector<std::string_view> queued_lines;
+		bool finished = false;
+		std::future<int64_t> exit_code;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		uint64_t wall_time_us = 0; // set when the tool exits
+
+		scanner_process(std::string_view tool_path, std::string_view comp_db_path) {
+			CmdArgs cmd { "\"{}\" --compilation-database=\"{}\"", tool_path, comp_db_path };
+			exit_code = eager_future([this, cmd = std::move(cmd)]() mutable {
+				auto set_finished = [&] {
+					std::lock_guard lock { queue_mutex };
+					wall_time_us = get_elapsed_us(start);
+					finished = true;
+					queue_cv.notify_one();
+				};
+				try {
+					auto ret = run_cmd_read_lines(cmd, [&](std::string_view line) {
+						// todo: use the stable buffer inside run_cmd_read_lines to avoid this copy
+						// todo: store only a single copy of each file/module name
+						line = read_lines.copy(line);
+						std::lock_guard lock { queue_mutex };
+						queued_lines.push_back(line);
+						if (queued_lines.size() == 1)
+							queue_cv.notify_one();
+						return true;
+					}, [](std::string_view err_line) {
+						// todo: record and return errors for each item
+						fmt::print("ERR: {}\n", err_line);
+						return true;
+					});
+					set_finished();
+					return ret;
+				} catch (...) {
+					set_finished();
+					throw;
+				}
+			});
+		}
+		scanner_process(const scanner_process&) = delete;
+
+		// calls f for each line of the output, until the tool exits
+		template<typename F>
+		int64_t read_lines_until_exit(F&& f) {
+			std::vector<std::string_view> lines;
+			while (true) {
+				{
+					std::unique_lock lock { queue_mutex };
+					queue_cv.wait(lock, [&] { return finished || !queued_lines.empty(); });
+					if (queued_lines.empty())
+						break; // finished
+					std::swap(lines, queued_lines);
+				}
+				for (auto line : lines)
+					f(line);
+				lines.clear();
+			}
+			return exit_code.get();
+		}
+	};
+
 	struct scanner_data {
 		vector_map<scan_item_idx_t, char> got_result;
-		stable_multi_string_buffer read_lines;
 		reordered_multi_vector_buffer<scan_item_idx_t, file_id_t> file_deps_buf;
 		reordered_multi_vector_buffer<scan_item_idx_t, item_id_t> item_deps_buf;
 		reordered_multi_vector_buffer<scan_item_idx_t, module_id_t> imports_buf;
+		// the new DB entries for the items that got results
+		DB::item_write_batch write_batch;
 	};
-	auto execute_scanner(std::string_view tool_path, std::string_view comp_db_path,
+	// note: the process must only be null if there are no out of date items
+	auto execute_scanner(scanner_process* process,
 		span_map<file_id_t, std::pair<scan_item_idx_t, db_target_id> > header_unit_lookup,
+		span_map<scan_item_idx_t, const ScanItemView> items,
 		span_map<scan_item_idx_t, file_id_t> item_file_ids,
+		span_map<scan_item_idx_t, db_target_id> item_target_ids,
+		const vector_map<cmd_idx_t, cmd_hash_t>& cmd_hashes,
+		file_time_t last_successful_scan,
 		const std::vector<scan_item_idx_t>& ood_items, DepInfoObserver* observer,
 		/*inout: */span_map<scan_item_idx_t, tcb::span<file_id_t>> file_deps,
 		/*inout: */span_map<scan_item_idx_t, tcb::span<item_id_t>> item_deps,
@@ -721,7 +705,7 @@ struct ScannerImpl {
 		// todo: reserve memory for the other buffers here
 		data.got_result.resize(imports.size());
 
-		if (ood_items.empty())
+		if (ood_items.empty() || !process)
 			return data;
 
 		auto starts_with = [](std::string_view a, std::string_view b) {
@@ -729,14 +713,28 @@ struct ScannerImpl {
 		};
 		scan_item_idx_t current_item_idx = {};
 		bool first = true;
+		std::unique_lock<std::mutex> observer_lock { observer_mutex, std::defer_lock };
 
-		CmdArgs cmd { "\"{}\" --compilation-database=\"{}\"", tool_path, comp_db_path };
-#if 0
-		auto ret = run_cmd_parse_json(cmd, [&](const nlohmann::json& json) {
-		});
-#endif
+		// stage the DB entry for an item as soon as all of its results were read
+		auto item_finished = [&] {
+			auto i = current_item_idx;
+			data.write_batch.add(item_id_t {
+				item_file_ids[i],
+				item_target_ids[i]
+			}, DB::item_entry {
+				cmd_hashes[items[i].command_idx],
+				last_successful_scan,
+				data.file_deps_buf.peek_last_span(),
+				data.item_deps_buf.peek_last_span(),
+				exports[i],
+				data.imports_buf.peek_last_span()
+			});
+			if (observer) {
+				observer->item_finished();
+				observer_lock.unlock();
+			}
+		};
 
-#if 1
 		auto get_item_idx = [&](std::string_view line) {
 			// parse the comp db entry index from e.g ":::: 2"
 			uint32_t idx = 0;
@@ -746,22 +744,23 @@ struct ScannerImpl {
 			return ood_items[idx];
 		};
 	
-		auto ret = run_cmd_read_lines(cmd, [&](std::string_view line) {
+		std::size_t bytes_parsed = 0;
+		auto ret = process->read_lines_until_exit([&](std::string_view line) {
 			//fmt::print("{}\n", line);
-
-			// todo: use the stable buffer inside run_cmd_read_lines to avoid this copy
-			// todo: store only a single copy of each file/module name
-			line = data.read_lines.copy(line);
+			bytes_parsed += line.size() + 1;
 
 			if (starts_with(line, ":::: ")) {
-				if (observer && !first) observer->item_finished();
+				if (!first) item_finished();
 				first = false;
 				current_item_idx = get_item_idx(line);
 				data.file_deps_buf.new_vector(current_item_idx);
 				data.item_deps_buf.new_vector(current_item_idx);
 				data.imports_buf.new_vector(current_item_idx);
 				data.got_result[current_item_idx] = true;
-				if(observer) observer->results_for_item(current_item_idx, /*out_of_date=*/true);
+				if (observer) {
+					observer_lock.lock();
+					observer->results_for_item(current_item_idx, /*out_of_date=*/true);
+				}
 			} else if (starts_with(line, ":exp ")) {
 				auto name = line.substr(5);
 				exports[current_item_idx] = db.try_add_module(name);
@@ -796,18 +795,15 @@ struct ScannerImpl {
 					}
 				}
 			}
-			return true;
-		}, [](std::string_view err_line) {
-			// todo: record and return errors for each item
-			fmt::print("ERR: {}\n", err_line);
-			return true;
 		});
-#endif
 
 		//if(ret != 0)
-			//throw std::runtime_error(fmt::format("failed to execute scanner tool - command '{}' returned {}", cmd.to_string(), ret));
+			//throw std::runtime_error(fmt::format("failed to execute scanner tool - returned {}", ret));
 
-		if (observer && !first) observer->item_finished();
+		if (!first) item_finished();
+		TRACE_COUNTER("bytes parsed", bytes_parsed);
+		stats.tool_output_bytes_parsed = bytes_parsed;
+		stats.scanner_wall_time_us = process->wall_time_us;
 
 		data.file_deps_buf.to_vectors(file_deps);
 		data.item_deps_buf.to_vectors(item_deps);
@@ -909,14 +905,17 @@ struct ScannerImpl {
 			items, imports, exported_by, scan_item_deps);
 	}
 
-	void submit_up_to_date_items(tcb::span<scan_item_idx_t> utd_items, DB::item_data & item_data, 
-		span_map<file_id_t, std::string_view> file_paths, DepInfoObserver* observer)
+	// note: this runs concurrently with execute_scanner so it must not use the DB
+	// and it can only read item_data for the up to date items
+	void submit_up_to_date_items(tcb::span<scan_item_idx_t> utd_items, const DB::item_data & item_data, 
+		span_map<file_id_t, std::string_view> file_paths, 
+		const vector_map<module_id_t, std::string_view>& module_names, DepInfoObserver* observer)
 	{
 		if (!observer)
 			return;
 		TRACE();
-		auto module_names = db.get_all_module_names();
 		for (auto i : utd_items) {
+			std::lock_guard observer_lock { observer_mutex };
 			observer->results_for_item(i, /*out_of_date=*/false);
 			// todo: store headers and other deps separately ?
 			for (auto file_id : item_data.file_deps[i])
@@ -953,66 +952,207 @@ struct ScannerImpl {
 		bool commands_contain_item_path, span_map<cmd_idx_t, std::string_view> commands,
 		span_map<target_idx_t, std::string_view> targets, 
 		span_map<scan_item_idx_t, const ScanItemView> items,
-		bool concurrent_targets, bool file_tracker_running,
-		DepInfoObserver * observer, bool submit_previous_results, CollatedModuleInfo * collated_results)
+		bool concurrent_targets, bool file_tracker_running, bool cache_minimized_sources,
+		Scanner::Durability durability, double auto_gc_growth, bool partitioned_db,
+		DepInfoObserver * observer, bool submit_previous_results, CollatedModuleInfo * collated_results,
+		ScanStats * out_stats, vector_map<scan_item_idx_t, ItemFingerprint> * out_fingerprints)
 	{
 		TRACE();
-
+		stats = {};
+
+		// the front half of the scan is a small task graph:
+		// - hash the commands
+		// - stat the items
+		// - open the DB -> target ids -> item data -> unique deps -> stat the deps
+		// and the item ood states need all three, but the first two
+		// don't depend on the DB so they run on other threads meanwhile
 		// todo: we may not need to recompute some of this if we can detect that the environment stays constant
-		// todo: do this while reading data from the DB, use an eager future
-		auto cmd_hashes = get_cmd_hashes(commands);
+		auto cmd_hashes_future = eager_future([&] { return get_cmd_hashes(commands); });
 
-		// todo: estimate db size if it doesn't use a sparse file ?
+		// todo: would this be faster with a named pipe ? or sending directly to stdin ?
+		auto comp_db_path = concat_u8_path(int_dir, "pp_commands.json");
 
-		db.open(db_path, "scanner.mdb");
+		// if there's no history then all of the items are out of date, so there's nothing
+		// to stat or compare and the scanner can be started before the DB is even opened,
+		// while the paths/targets are interned here concurrently with the scanning
+		std::optional<scanner_process> cold_process;
+		std::vector<scan_item_idx_t> all_items;
+		file_time_t cold_scan_start = {};
+		auto start_cold_scan = [&] {
+			TRACE_BLOCK("start the cold scan");
+			all_items.reserve((std::size_t)items.size());
+			for (auto i : items.indices())
+				all_items.push_back(i);
+			generate_compilation_database(commands_contain_item_path, commands,
+				item_root_path, items, all_items, comp_db_path);
+			// files changed while scanning will be out of date next time
+			cold_scan_start = file_time_t_now();
+			if (!all_items.empty())
+				cold_process.emplace(tool_path, comp_db_path);
+		};
+		if (!fs::exists(fs::u8path(db_path) / "scanner.mdb"))
+			start_cold_scan();
+
+		// note: if the DB turns out to be empty later then these stats are just wasted
+		auto item_lwts_future = eager_future([&, cold_started = cold_process.has_value()] {
+			if (file_tracker_running || cold_started) // the write times will be read from the DB / aren't needed
+				return vector_map<scan_item_idx_t, file_time_t> {};
+			return get_item_last_write_times(item_root_path, items);
+		});
+
+		if (partitioned_db)
+			db.open_partitioned(db_path, targets, durability, (std::size_t)items.size());
+		else
+			db.open(db_path, "scanner.mdb", durability, (std::size_t)items.size());
 
 		// todo: maybe we could somehow do a read only transaction here
 		// and then switch to a read-write transaction (possibly reading more) only if needed ?
 		db.read_write_transaction();
+		stats.db_rebuilt = db.rebuilt || db.shared.rebuilt;
+		std::size_t last_page_before_scan = db.get_last_page_number();
+		// e.g if the DB was left empty by a scan that failed or by clean
+		// note: if another scan created the DB in the meantime, treating everything as new is still correct
+		if (!cold_process && !items.empty() && db.has_no_items())
+			start_cold_scan();
+		bool cold = cold_process.has_value();
+
 		auto item_target_ids = get_item_target_ids(items, targets);
-		// note: the following also returns new file/item ids for files/items not in the db yet
-		auto item_data = db.get_item_data(item_target_ids, item_root_path, items);
-		// todo: if concurrent_targets == false, it might be more efficient to assume all files are deps ?
-		auto unique_deps = get_unique_deps(item_data.file_deps, item_data.file_id, item_data.max_file_id);
-		auto [real_lwt, deps_to_stat] = remove_deps_already_stated(unique_deps,
-			file_tracker_running, item_data.max_file_id);
-		auto need_paths_for = deps_to_stat.to_span();
-		if (observer && submit_previous_results) need_paths_for = unique_deps.to_span();
-		auto file_paths = get_file_paths(item_root_path, items, item_data.file_id, need_paths_for, item_data.max_file_id);
-		// todo: if the log is empty then we can stat items and compute hashes in parallel with scanning
-		get_file_ood(item_root_path, deps_to_stat, file_paths, /*inout: */real_lwt);
-		auto item_ood = get_item_ood(items, item_data, cmd_hashes, real_lwt, /*just for logging*/file_paths); // maybe do the cmd_hashes check later, close txn faster ?
-		auto item_lookup = get_item_lookup(item_target_ids, item_data.file_id);
-		auto scan_item_deps = get_item_deps_ood(/*inout*/item_ood, item_data.item_deps, item_lookup);
-		auto [ood_items, utd_items] = partition_items_by_ood(item_ood);
-		// todo: the notification and the write could happen in parallel with scanning
+		DB::item_data item_data;
+		vector_map<scan_item_idx_t, ood_state> item_ood;
+		vector_map<scan_item_idx_t, std::vector<scan_item_idx_t>> scan_item_deps;
+		std::vector<scan_item_idx_t> ood_items, utd_items;
+		vector_map<file_id_t, std::string_view> file_paths;
+		std::string vfs_overlay_path;
+		vector_map<file_id_t, char> minimized_hit;
+		vector_map<cmd_idx_t, cmd_hash_t> cmd_hashes;
+		auto wait_for_cmd_hashes = [&] {
+			TRACE_BLOCK("wait for the command hashes");
+			cmd_hashes = cmd_hashes_future.get();
+		};
+		if (cold) {
+			// e.g if the DB turned out to be empty, the item stats may still be running
+			// and they update the stats, so they have to be joined before the stats are reported
+			{
+				TRACE_BLOCK("wait for the item stats");
+				item_lwts_future.get();
+			}
+			item_data = db.get_new_item_data(item_root_path, items);
+			item_ood.assign((std::size_t)items.size(), ood_state::new_file);
+			scan_item_deps.resize(items.size());
+			ood_items = std::move(all_items);
+			wait_for_cmd_hashes();
+		} else {
+			// note: the following also returns new file/item ids for files/items not in the db yet
+			item_data = db.get_item_data(item_target_ids, item_root_path, items);
+			// todo: if concurrent_targets == false, it might be more efficient to assume all files are deps ?
+			auto [unique_deps, nr_item_files] = get_unique_deps(item_data.file_deps, item_data.file_id, item_data.max_file_id);
+			auto item_lwts = [&] {
+				TRACE_BLOCK("wait for the item stats");
+				return item_lwts_future.get();
+			}();
+			auto [real_lwt, deps_to_stat] = remove_deps_already_stated(unique_deps, nr_item_files,
+				item_data.file_id, item_lwts, file_tracker_running, item_data.max_file_id);
+			auto need_paths_for = deps_to_stat.to_span();
+			if (observer && submit_previous_results) need_paths_for = unique_deps.to_span();
+			file_paths = get_file_paths(item_root_path, items, item_data.file_id, need_paths_for, item_data.max_file_id);
+			get_file_ood(item_root_path, deps_to_stat, file_paths, /*inout: */real_lwt);
+			wait_for_cmd_hashes();
+			item_ood = get_item_ood(items, item_data, cmd_hashes, real_lwt, /*just for logging*/file_paths); // maybe do the cmd_hashes check later, close txn faster ?
+			auto item_lookup = get_item_lookup(item_target_ids, item_data.file_id);
+			scan_item_deps = get_item_deps_ood(/*inout*/item_ood, item_data.item_deps, item_lookup);
+			auto partitioned = partition_items_by_ood(item_ood);
+			ood_items = std::move(partitioned.ood);
+			utd_items = std::move(partitioned.utd);
+			TRACE_COUNTER("items up to date", utd_items.size());
+			if (cache_minimized_sources)
+				vfs_overlay_path = use_minimized_sources(int_dir, ood_items, item_data, real_lwt, minimized_hit);
+		}
+		TRACE_COUNTER("items out of date", ood_items.size());
+		scanned_item_ids.resize(items.size());
+		for (auto i : items.indices())
+			scanned_item_ids[i] = { item_data.file_id[i], item_target_ids[i] };
+		if (out_fingerprints)
+			*out_fingerprints = db.get_fingerprints(scanned_item_ids, item_data.db_max_file_id);
+		if(collated_results || ood_items.size() > 0 || (observer && submit_previous_results))
+			db.init_stores(); // used by execute_scanner, submit_up_to_date_items and collate_module_deps
+
+		// the up to date items are submitted to the observer while the scanner is running
 		// note: the observer must not launch another scan on the same DB while we're holding the transaction lock
-		if(observer && submit_previous_results)
-			submit_up_to_date_items(utd_items, item_data, file_paths, observer);
-		if(collated_results || ood_items.size() > 0)
-			db.init_stores(); // used by execute_scanner and collate_module_deps
+		std::future<void> submit_future;
+		if (observer && submit_previous_results && !utd_items.empty()) {
+			// the scanner may add new modules, so the notification needs a copy of the names
+			vector_map<module_id_t, std::string_view> module_names = db.get_all_module_names();
+			submit_future = eager_future([&, module_names = std::move(module_names)] {
+				submit_up_to_date_items(utd_items, item_data, file_paths, module_names, observer);
+			});
+		}
 
-		// todo: load/store the minimized source files for clang-scan-deps from the DB
-		// todo: would this be faster with a named pipe ? or sending directly to stdin ?
-		auto comp_db_path = concat_u8_path(int_dir, "pp_commands.json");
-		generate_compilation_database(commands_contain_item_path, commands,
-			item_root_path, items, ood_items, comp_db_path);
+		auto last_successful_scan = cold_scan_start;
+		std::optional<scanner_process> warm_process;
+		if (!cold) {
+			generate_compilation_database(commands_contain_item_path, commands,
+				item_root_path, items, ood_items, comp_db_path, vfs_overlay_path);
+			// files changed while scanning will be out of date next time
+			last_successful_scan = file_time_t_now();
+			if (!ood_items.empty())
+				warm_process.emplace(tool_path, comp_db_path);
+		}
 		auto header_unit_lookup = get_header_unit_lookup(items, item_data.file_id, 
 			item_target_ids, item_data.max_file_id);
-		auto data = execute_scanner(tool_path, comp_db_path, 
-			header_unit_lookup, item_data.file_id, ood_items, observer,
+		auto* process = cold ? &*cold_process : (warm_process ? &*warm_process : nullptr);
+		auto data = execute_scanner(process,
+			header_unit_lookup, items, item_data.file_id, item_target_ids, cmd_hashes,
+			last_successful_scan, ood_items, observer,
 			/*inout: */item_data.file_deps, item_data.item_deps, scan_item_deps, item_data.exports, item_data.imports);
+		if (submit_future.valid()) {
+			TRACE_BLOCK("wait for the up to date items to be submitted");
+			submit_future.get();
+		}
 
 		if (collated_results)
 			collate_module_deps(/*inout:*/collated_results, items,
 				item_data.exports, item_data.imports, scan_item_deps, db.module_store.next_id - 1);
 
+		minimized_sources minimized;
+		if (cache_minimized_sources)
+			minimized = minimize_sources(int_dir, ood_items, data.got_result, item_data.file_deps, minimized_hit);
+
 		// note: the deps/modules in item_data become invalid once we start writing to the db
 		// note: the hash maps for path/module_store become invalid as well and they're used while scanning
 
+		stats.db_pages_upper_bound = db.get_nr_pages_upper_bound();
+		stats.new_paths = (std::size_t)db.path_store.next_id - (std::size_t)db.path_store.db_max_id - 1;
+		if (!ood_items.empty()) // otherwise the module store may not have been initialized
+			stats.new_modules = (std::size_t)db.module_store.next_id - (std::size_t)db.module_store.db_max_id - 1;
+
+		// the shared env is updated first, so that the items never refer to ids that aren't in it
+		if (partitioned_db) {
+			auto remap = db.merge_shared_stores();
+			if (remap.changed) {
+				data.write_batch = DB::remap_items(data.write_batch, remap);
+				for (std::size_t idx = 0; idx < minimized.files.size(); ++idx) {
+					auto& file = minimized.files[idx];
+					if (remap.files[file] == file)
+						continue;
+					// the materialized copy is named after the old id
+					std::error_code ec;
+					fs::remove(get_minimized_file_path(int_dir, file, minimized.lwts[idx]), ec);
+					file = remap.files[file];
+				}
+				for (auto& id : scanned_item_ids)
+					id.file_id = remap.files[id.file_id];
+			}
+		}
+
 		// todo: maybe break this function up ?
-		db.update_items(item_ood, item_target_ids, items, item_data.file_id, cmd_hashes, 
-			data.got_result, item_data.file_deps, item_data.item_deps, item_data.exports, item_data.imports);
+		// note: if the map is full then the changes are made again after growing it
+		bool gc_due = false;
+		db.write_and_commit([&] {
+			minimized.put(db);
+			db.update_items(data.write_batch);
+			if (auto_gc_growth > 0 && !concurrent_targets && !partitioned_db)
+				gc_due = db.is_gc_due(auto_gc_growth);
+		});
 		// changes to:
 		// targets:
 		// - new ids
@@ -1026,26 +1166,101 @@ struct ScannerImpl {
 		// - deps,export/import changed
 		// modules:
 		// - new ids
-		db.commit_transaction();
+		stats.db_map_growths = db.map_growths;
+		stats.db_pages_written = db.get_last_page_number() - last_page_before_scan;
+		for (auto ood : item_ood)
+			stats.items_by_ood_state[(std::size_t)ood]++;
+		if (gc_due) {
+			gc_open_db(int_dir);
+			stats.db_gc_ran = true;
+			db_closed = true;
+		}
+		if (out_stats)
+			*out_stats = stats;
 
-		// todo: maybe run stat on the non-ood output files while the scanner is running
-		// to get the OS to cache them and reduce the overhead of ninja restatting them afterwards ?
+		// note: the ninja generator can stat the outputs of the up to date items while the scanner
+		// is running (see OutputPrefetcher), since the output paths aren't known here
 
 		// todo: maybe cleanup things that were removed ?
 		return get_results(data.got_result, item_ood);
 	}
 
+	void put_fingerprints(std::string_view db_path, span_map<scan_item_idx_t, const ItemFingerprint> fingerprints) {
+		TRACE();
+		if (scanned_item_ids.size() != fingerprints.size())
+			throw std::invalid_argument("the fingerprints must be for the items of the last scan");
+		reopen_after_gc(db_path);
+		db.read_write_transaction();
+		db.write_and_commit([&] {
+			db.put_fingerprints(scanned_item_ids, fingerprints);
+		});
+	}
+
+	void reopen_after_gc(std::string_view db_path) {
+		if (!db_closed)
+			return;
+		db.open(db_path, "scanner.mdb", db.durability);
+		db_closed = false;
+		paths_stale = true;
+	}
+
+	// the ids of the files that were in the DB before the last scan, and invalid ids for the rest,
+	// since e.g in partitioned mode the new ones may have been renumbered when they were merged into the shared env
+	// note: this needs a transaction
+	std::vector<file_id_t> get_file_ids(std::string_view item_root_path, tcb::span<const std::string_view> paths) {
+		if (paths_stale) {
+			db.path_store.read_paths(db.txn_rw, item_root_path);
+			paths_stale = false;
+		}
+		std::vector<file_id_t> file_ids(paths.size());
+		for (std::size_t idx = 0; idx < paths.size(); ++idx) {
+			auto file_id = db.path_store.find(paths[idx]);
+			if (file_id.is_valid() && file_id <= db.path_store.db_max_id)
+				file_ids[idx] = file_id;
+		}
+		return file_ids;
+	}
+
+	std::vector<FileDigest> get_file_digests(std::string_view db_path, std::string_view item_root_path,
+		tcb::span<const std::string_view> paths)
+	{
+		TRACE();
+		reopen_after_gc(db_path);
+		db.read_write_transaction();
+		auto file_ids = get_file_ids(item_root_path, paths);
+		std::vector<FileDigest> digests(paths.size());
+		db.get_file_digests(file_ids, digests);
+		db.end_write_transaction(); // abort, nothing was written
+		return digests;
+	}
+
+	void put_file_digests(std::string_view db_path, std::string_view item_root_path,
+		tcb::span<const std::string_view> paths, tcb::span<const FileDigest> digests)
+	{
+		TRACE();
+		reopen_after_gc(db_path);
+		db.read_write_transaction();
+		auto file_ids = get_file_ids(item_root_path, paths);
+		db.write_and_commit([&] {
+			db.put_file_digests(file_ids, digests);
+		});
+	}
+
 	void clean(std::string_view db_path, std::string_view item_root_path,
 		span_map<target_idx_t, std::string_view> targets,
-		span_map<scan_item_idx_t, const ScanItemView> items)
+		span_map<scan_item_idx_t, const ScanItemView> items, bool partitioned_db)
 	{
-		db.open(db_path, "scanner.mdb");
+		if (partitioned_db)
+			db.open_partitioned(db_path, targets);
+		else
+			db.open(db_path, "scanner.mdb");
 
 		db.read_write_transaction();
 		auto target_ids = db.get_target_ids(targets);
 		auto item_file_ids = db.get_item_file_ids(item_root_path, items);
-		db.remove_items(target_ids, items, item_file_ids); 
-		db.commit_transaction();
+		db.write_and_commit([&] {
+			db.remove_items(target_ids, items, item_file_ids);
+		});
 		// note: the files are never removed, only the items, is that ok ?
 		// todo: how about target ids ? should they ever get removed ?
 	}
@@ -1053,6 +1268,40 @@ struct ScannerImpl {
 	void clean_all(fs::path db_path) {
 		fs::remove(db_path / "scanner.mdb");
 		fs::remove(db_path / "scanner.mdb-lock");
+		fs::remove(db_path / "scanner.mdb-users");
+		fs::remove(db_path / "scanner.mdb-writers");
+		for (auto& file : DB::get_partition_files(db_path.string()))
+			fs::remove(file);
+	}
+
+	// note: the DB must be open, but without a transaction, and it's closed after this
+	GcStats gc_open_db(std::string_view int_dir) {
+		TRACE();
+		GcStats stats;
+		std::error_code ec;
+		stats.db_size_before = (std::size_t)fs::file_size(fs::u8path(db.db_file_path), ec);
+		db.read_write_transaction();
+		DB::gc_id_remap remap;
+		db.write_and_commit([&] {
+			remap = db.remove_unused_ids(stats);
+		});
+		db.compact();
+		stats.db_size_after = (std::size_t)fs::file_size(fs::u8path(db.db_file_path), ec);
+		// the fingerprints of the last scan are put with the new ids
+		for (auto& id : scanned_item_ids)
+			id = remap.get(id);
+		// the gc removed the minimized sources from the DB, and the materialized ones are named after the old file ids
+		if (!int_dir.empty())
+			fs::remove_all(fs::u8path(int_dir) / "minimized", ec);
+		return stats;
+	}
+
+	GcStats gc(std::string_view db_path, std::string_view int_dir) {
+		// the ids would have to be renumbered in all the partitions at once
+		if (!DB::get_partition_files(db_path).empty())
+			throw std::runtime_error("gc is not supported for partitioned DBs");
+		db.open(db_path, "scanner.mdb");
+		return gc_open_db(int_dir);
 	}
 
 	void print_db(std::string_view db_path) {
@@ -1104,8 +1353,36 @@ vector_map<scan_item_idx_t, Scanner::Result> Scanner::scan(const ConfigView & cc
 
 	return impl->scan(c.tool_type, c.tool_path, c.db_path, c.int_dir, ci.item_root_path,
 		ci.commands_contain_item_path, ci.commands, ci.targets, ci.items,
-		c.concurrent_targets, c.file_tracker_running,
-		c.observer, c.submit_previous_results, c.collated_results);
+		c.concurrent_targets, c.file_tracker_running, c.cache_minimized_sources,
+		c.durability, c.auto_gc_growth, c.partitioned_db, c.observer, c.submit_previous_results, c.collated_results, c.stats,
+		c.fingerprints);
+}
+
+void Scanner::put_fingerprints(const ConfigView& c, span_map<scan_item_idx_t, const ItemFingerprint> fingerprints) {
+	if (c.item_set.items.empty()) // nothing was scanned
+		return;
+	if (fingerprints.size() != c.item_set.items.size())
+		throw std::invalid_argument("must provide a fingerprint for each item");
+
+	impl->put_fingerprints(c.db_path, fingerprints);
+}
+
+std::vector<FileDigest> Scanner::get_file_digests(const ConfigView& c, tcb::span<const std::string_view> paths) {
+	if (c.item_set.items.empty()) // nothing was scanned
+		return std::vector<FileDigest>(paths.size());
+
+	return impl->get_file_digests(c.db_path, c.item_set.item_root_path, paths);
+}
+
+void Scanner::put_file_digests(const ConfigView& c, tcb::span<const std::string_view> paths,
+	tcb::span<const FileDigest> digests)
+{
+	if (c.item_set.items.empty())
+		return;
+	if (digests.size() != paths.size())
+		throw std::invalid_argument("must provide a digest for each path");
+
+	impl->put_file_digests(c.db_path, c.item_set.item_root_path, paths, digests);
 }
 
 void Scanner::clean(const ConfigView & c) {
@@ -1116,7 +1393,7 @@ void Scanner::clean(const ConfigView & c) {
 	if (c.db_path.empty()) throw std::invalid_argument("must provide a db path");
 	if (ci.targets.empty()) throw std::invalid_argument("must provide at least one target");
 
-	impl->clean(c.db_path, ci.item_root_path, ci.targets, ci.items);
+	impl->clean(c.db_path, ci.item_root_path, ci.targets, ci.items, c.partitioned_db);
 }
 
 void Scanner::clean_all(std::string_view db_path) {
@@ -1125,6 +1402,12 @@ void Scanner::clean_all(std::string_view db_path) {
 	impl->clean_all(db_path);
 }
 
+GcStats Scanner::gc(std::string_view db_path, std::string_view int_dir) {
+	if (db_path.empty()) throw std::invalid_argument("must provide a db path");
+
+	return impl->gc(db_path, int_dir);
+}
+
 inline bool ends_with(std::string_view str, std::string_view with) {
 	if (str.size() < with.size()) return false;
 	return str.substr(str.size() - with.size(), with.size()) == with;
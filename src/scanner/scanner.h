@@ -3,6 +3,8 @@
 #include <vector>
 #include <string_view>
 #include <memory>
+#include <array>
+#include <cstdint>
 #include "span.hpp"
 
 #include "depinfo.h"
@@ -141,6 +143,73 @@ enum class scan_state {
 	success // scanned successfully
 };
 
+// statistics about a single scan, e.g to see why items were rescanned and where the time went
+struct ScanStats
+{
+	// the number of items in each ood_state
+	std::array<std::size_t, (std::size_t)ood_state::up_to_date + 1> items_by_ood_state = {};
+	// the items and their deps stated to check if they're up to date
+	std::size_t files_stated = 0;
+	uint64_t stat_time_us = 0;
+	// note: LMDB doesn't count the pages read, so pages_upper_bound is the number of pages in the tables that were read
+	// and pages_written only includes the pages appended to the file, not the ones reused from the free list
+	std::size_t db_pages_upper_bound = 0;
+	std::size_t db_pages_written = 0;
+	// from launching the scanner tool until it exits
+	uint64_t scanner_wall_time_us = 0;
+	std::size_t tool_output_bytes_parsed = 0;
+	// interned in the DB by this scan
+	std::size_t new_paths = 0;
+	std::size_t new_modules = 0;
+	// how many times the DB's map was full and had to grow
+	std::size_t db_map_growths = 0;
+	// the DB was torn by a crash (see Scanner::Durability) so it was rebuilt from scratch
+	bool db_rebuilt = false;
+	// the DB was garbage collected after the scan (see Scanner::Config::auto_gc_growth)
+	bool db_gc_ran = false;
+};
+
+// the number of ids in each of the DB's stores before/after garbage collection
+struct GcStats
+{
+	std::size_t paths_before = 0, paths_after = 0;
+	std::size_t modules_before = 0, modules_after = 0;
+	std::size_t targets_before = 0, targets_after = 0;
+	std::size_t items = 0;
+	// in bytes
+	std::size_t db_size_before = 0, db_size_after = 0;
+};
+
+// recorded by a build system generator for each item after it wrote the item's files,
+// so that on the next scan it can skip regenerating them if nothing changed (see NinjaGenerator::scan)
+struct ItemFingerprint
+{
+	// e.g of the dyndep line, which depends on the item's imports and outputs
+	uint64_t deps_hash = 0;
+	// e.g of the module flags in the response file
+	uint64_t flags_hash = 0;
+	// the last write time of the generated file (as a file_time_t), after it was written
+	uint64_t write_time = 0;
+
+	bool is_valid() const { return write_time != 0; }
+	bool operator==(const ItemFingerprint& o) const {
+		return deps_hash == o.deps_hash && flags_hash == o.flags_hash && write_time == o.write_time;
+	}
+	bool operator!=(const ItemFingerprint& o) const { return !(*this == o); }
+};
+
+// recorded by a build system generator for the files that the items depend on, e.g for the BMI cache keys,
+// so that next time only the files that were written since have to be read again
+struct FileDigest
+{
+	// the last write time of the file (as a file_time_t) when it was read
+	uint64_t last_write_time = 0;
+	// e.g a 128 bit digest of the contents
+	uint64_t a = 0, b = 0;
+
+	bool is_valid() const { return last_write_time != 0; }
+};
+
 struct DepInfoObserver {
 	struct RawDataBlockView {
 		std::string_view format;
@@ -181,11 +250,23 @@ struct CollatedModuleInfo
 // todo: refactor this
 struct ModuleVisitor : public CollatedModuleInfo 
 {
-	std::vector<scan_item_idx_t> queue;
-	std::vector<bool> is_in_queue;
+	// the scratch space for visiting the imports, each thread visiting them at the same time needs its own
+	struct visit_state {
+		std::vector<scan_item_idx_t> queue;
+		std::vector<bool> is_in_queue;
+	};
+	visit_state state;
 
 	template<typename F>
 	void visit_transitive_imports(scan_item_idx_t root_idx, F&& visitor_func) {
+		visit_transitive_imports(state, root_idx, std::forward<F>(visitor_func));
+	}
+
+	// note: this can be called from multiple threads, with a different state for each
+	template<typename F>
+	void visit_transitive_imports(visit_state& state, scan_item_idx_t root_idx, F&& visitor_func) const {
+		auto& queue = state.queue;
+		auto& is_in_queue = state.is_in_queue;
 		queue.resize((std::size_t)imports_item.size());
 		if (queue.empty())
 			return;
@@ -217,6 +298,14 @@ public:
 		CLANG_SCAN_DEPS
 	};
 
+	// the DB is only a cache, so it doesn't always need to be synced to the disk
+	// if a system crash tears it then it will be rebuilt on the next scan
+	enum class Durability {
+		FULL, // sync the data and the meta pages on every commit
+		NO_META_SYNC, // sync the data but not the meta pages, a system crash may undo the last commit
+		ASYNC // let the OS write the memory mapped DB asynchronously, a system crash may tear the DB
+	};
+
 	template<
 		typename string_t, // note: all of the input strings should be UTF-8
 		template < typename, typename > typename map_t
@@ -239,6 +328,20 @@ public:
 		bool concurrent_targets = true;
 		// if true: assume the stat times in the DB are up to date:
 		bool file_tracker_running = false;
+		// if true: keep the sources minimized for the scanner tool in the DB, so that
+		// rescanning an item doesn't need to read and minimize its unchanged headers again
+		bool cache_minimized_sources = false;
+		// how much to sync the DB to the disk when committing changes:
+		Durability durability = Durability::FULL;
+		// if > 0: garbage collect the DB after a scan if any of the path/module/target stores
+		// grew to more than this many times their size after the last gc (see Scanner::gc)
+		// note: this is ignored if concurrent_targets = true
+		double auto_gc_growth = 0;
+		// if true: the items of each set of targets are kept in their own DB file next to a shared one
+		// with the paths/modules/targets, so that concurrent scans of different targets don't wait for
+		// each other to finish, only for the short transactions that add new targets/paths/modules
+		// note: Scanner::gc is not supported for partitioned DBs
+		bool partitioned_db = false;
 		// scan results are sent to this observer:
 		DepInfoObserver* observer = nullptr;
 		// submit scan results to the observer from previous scans for up-to-date items
@@ -246,6 +349,11 @@ public:
 		// the collated module dependency information will be stored here (if needed)
 		// note: requires submit_previous_results = true
 		CollatedModuleInfo* collated_results = nullptr;
+		// statistics about the scan will be stored here (if needed)
+		ScanStats* stats = nullptr;
+		// the fingerprints recorded with Scanner::put_fingerprints will be stored here (if needed)
+		// note: the items that don't have one get an invalid fingerprint
+		vector_map<scan_item_idx_t, ItemFingerprint>* fingerprints = nullptr;
 
 		template<
 			typename other_string_t,
@@ -260,9 +368,15 @@ public:
 			ret.item_set = ScanItemSetBase<string_t, map_t>::from(conf.item_set);
 			ret.concurrent_targets = conf.concurrent_targets;
 			ret.file_tracker_running = conf.file_tracker_running;
+			ret.cache_minimized_sources = conf.cache_minimized_sources;
+			ret.durability = conf.durability;
+			ret.auto_gc_growth = conf.auto_gc_growth;
+			ret.partitioned_db = conf.partitioned_db;
 			ret.observer = conf.observer;
 			ret.submit_previous_results = conf.submit_previous_results;
 			ret.collated_results = conf.collated_results;
+			ret.stats = conf.stats;
+			ret.fingerprints = conf.fingerprints;
 			return ret;
 		}
 	};
@@ -281,12 +395,28 @@ public:
  
 	vector_map<scan_item_idx_t, Result> scan(const ConfigView& config);
 
+	// record the fingerprints of what was generated for the items, the invalid ones are skipped
+	// note: this must be called after scan, on the same Scanner with the same config
+	void put_fingerprints(const ConfigView& config, span_map<scan_item_idx_t, const ItemFingerprint> fingerprints);
+
+	// the digests recorded with put_file_digests for the files at the given paths (e.g the file deps of the items)
+	// note: this must be called after scan, on the same Scanner with the same config
+	// note: the files that weren't in the DB before the scan get an invalid digest, and their digests aren't recorded
+	std::vector<FileDigest> get_file_digests(const ConfigView& config, tcb::span<const std::string_view> paths);
+	void put_file_digests(const ConfigView& config, tcb::span<const std::string_view> paths, tcb::span<const FileDigest> digests);
+
 	// clean the targets/items specified in the config's itemset
 	void clean(const ConfigView& config);
 
 	// clean everything in the db at the given path
 	void clean_all(std::string_view db_path);
 
+	// remove the paths/modules/targets from the db at the given path that are no longer used
+	// by any of the items (e.g after clean) and then compact the db file
+	// note: this must not run while other processes are using the db
+	// note: the minimized sources cached in int_dir (if given) are removed too, since they're named after the old ids
+	GcStats gc(std::string_view db_path, std::string_view int_dir = {});
+
 	// print everything in the db at the given path, for debugging
 	void print_db(std::string_view db_path);
 };
@@ -0,0 +1,1043 @@
+#pragma once
+
+#pragma warning(disable:4275) // non dll-interface class 'std::runtime_error' used as base for dll-interface class 'fmt::v6::format_error'
+#include <fmt/format.h>
+#include <fmt/ostream.h> // for printing strong_ids
+
+#include <algorithm>
+#include <filesystem>
+#include <optional>
+
+#include "scanner.h"
+#include "lmdb_wrapper.h"
+#include "lmdb_path_store.h"
+#include "lmdb_store.h"
+#include "lmdb_string_store.h"
+#include "strong_id.h"
+#include "trace.h"
+#include "file_time.h"
+#include "file_lock.h"
+
+namespace cppm {
+
+DECL_STRONG_ID_INV(file_id_t, 0); // 0 is the invalid file id
+DECL_STRONG_ID(unique_deps_idx_t);
+DECL_STRONG_ID(to_stat_idx_t);
+DECL_STRONG_ID_INV(db_target_id, 0);
+DECL_STRONG_ID_INV(module_id_t, 0);
+
+using cmd_hash_t = std::size_t; // todo: probably needs a bigger hash to avoid collisions ? 
+struct item_id_t {
+	file_id_t file_id;
+	db_target_id target_id;
+	bool operator==(const item_id_t& other) const noexcept { // for unordered_map
+		return file_id == other.file_id && target_id == other.target_id;
+	}
+	friend std::ostream& operator <<(std::ostream& os, const item_id_t& i) {
+		os << "(" << i.file_id << "," << i.target_id << ")";
+		return os;
+	}
+};
+
+}
+
+namespace std {
+    // todo: get this to work for all strong ids
+	template <>
+	struct hash<cppm::item_id_t> {
+		std::size_t operator()(const cppm::item_id_t& x) const {
+			static_assert(sizeof(cppm::item_id_t) == sizeof(uint64_t), "size mismatch");
+			return std::hash<uint64_t>{}(*reinterpret_cast<const uint64_t*>(&x));
+		}
+	};
+}
+
+namespace cppm {
+
+namespace fs = std::filesystem;
+
+inline std::string concat_u8_path(std::string_view path, std::string_view filename) {
+	return (fs::u8path(path) / filename).string();
+}
+
+// an LMDB environment in a single file with its write transaction,
+// that can be rebuilt if it's torn by a crash and whose map grows as needed
+struct db_env {
+	// held shared while the env is open, and exclusively while the DB is being rebuilt
+	// note: this is declared before the env so that it's only unlocked after the env is closed
+	file_lock users_lock;
+	// held exclusively while the write transaction is open, like lmdb's own writer mutex, but this one
+	// can be kept while the transaction is restarted to grow the map, so no other process can commit in between
+	file_lock writers_lock;
+	bool writing = false;
+	mdb::mdb_env env;
+	mdb::mdb_txn_rw txn_rw;
+
+	std::string db_file_path;
+	Scanner::Durability durability = Scanner::Durability::FULL;
+	// true if the DB was found torn by a crash on the last read_write_transaction and got rebuilt
+	bool rebuilt = false;
+	// true if the DB file couldn't be opened because it's corrupted, then it's rebuilt like a torn DB
+	bool invalid = false;
+
+	// used to estimate the initial size of the map
+	std::size_t expected_nr_items = 0;
+	// how many times the map had to grow since the DB was opened
+	std::size_t map_growths = 0;
+
+	// enough for the expected number of items, so that the map usually doesn't need to grow
+	std::size_t get_initial_map_size() {
+		constexpr std::size_t MB = 1024 * 1024;
+#ifdef _WIN32
+		// the file takes up the whole map on windows, so start small
+		std::size_t size = 16 * MB;
+#else
+		// on linux we could just set an arbitrarily large value here,
+		// as the DB only taskes up as much space as needed anyway
+		std::size_t size = 512 * MB;
+#endif
+		// roughly the item entries with their deps and paths, doubled for the copy-on-write pages
+		constexpr std::size_t bytes_per_item = 2 * 1024;
+		size = std::max(size, expected_nr_items * bytes_per_item);
+		// don't shrink it below what a previous scan grew it to
+		std::error_code ec;
+		auto file_size = fs::file_size(fs::u8path(db_file_path), ec);
+		if (!ec)
+			size = std::max(size, (std::size_t)file_size);
+		return (size + MB - 1) / MB * MB;
+	}
+
+	void open_env() {
+		using namespace mdb::flags;
+		env.set_map_size(get_initial_map_size());
+		env.set_maxdbs(16);
+		unsigned int env_flags = env::nosubdir;
+		if (durability == Scanner::Durability::NO_META_SYNC)
+			env_flags |= env::nometasync;
+		else if (durability == Scanner::Durability::ASYNC)
+			env_flags |= env::writemap | env::mapasync;
+		env.open(db_file_path.c_str(), (mdb::flags::env)env_flags);
+	}
+
+	void open(std::string_view db_path, std::string_view db_file_name,
+		Scanner::Durability durability = Scanner::Durability::FULL, std::size_t expected_nr_items = 0)
+	{
+		TRACE();
+		db_file_path = concat_u8_path(db_path, db_file_name);
+		this->durability = durability;
+		this->expected_nr_items = expected_nr_items;
+		map_growths = 0;
+		// lmdb already locks its own lock file, so the users are tracked with a separate one
+		users_lock.open(db_file_path + "-users");
+		users_lock.lock_shared();
+		writers_lock.open(db_file_path + "-writers");
+		open_env_or_invalidate();
+	}
+
+	void open_env_or_invalidate() {
+		try {
+			open_env();
+			invalid = false;
+		} catch (mdb::corrupted_exception&) {
+			env = {};
+			invalid = true;
+		}
+	}
+
+	void begin_write_transaction() {
+		if (!writing) {
+			writers_lock.lock_exclusive();
+			writing = true;
+		}
+		txn_rw = env.txn_read_write();
+	}
+
+	// aborts the write transaction if it wasn't committed
+	void end_write_transaction() {
+		txn_rw = {};
+		if (writing) {
+			writers_lock.unlock();
+			writing = false;
+		}
+	}
+
+	void close_env() {
+		end_write_transaction();
+		env = {};
+	}
+
+	// the map grows geometrically so that a DB that keeps growing only needs a few retries
+	void grow_map() {
+		TRACE();
+		std::size_t new_size = env.get_map_size() * 2;
+		env.set_map_size(new_size);
+		++map_growths;
+		TRACE_COUNTER("db map size (MB)", new_size / (1024 * 1024));
+	}
+
+	struct db_header {
+		constexpr static int current_version = 3;
+		int version = current_version;
+	};
+
+	// written by every commit, to detect if the last commit was not synced and didn't make it to the disk
+	// note: this is stored separately from db_header so that the DBs written before this was added are still valid
+	struct db_epoch {
+		// the id of the transaction that wrote this, which should also be the last committed transaction
+		std::size_t epoch = 0;
+		// true if the commit was not fully synced
+		bool dirty = false;
+	};
+
+	// true if the last commit was not fully synced and (some of) it was lost, e.g by a system crash
+	// note: this only checks the epoch, not every page written by the last commit, so it's not bulletproof
+	bool is_torn() {
+		try {
+			auto dbi = txn_rw.open_db<uint64_t, db_epoch>("header");
+			db_epoch e = dbi.get(2);
+			// a write transaction's id is one more than the id of the last committed transaction
+			return e.dirty && e.epoch + 1 != txn_rw.id();
+		} catch (mdb::key_not_found_exception&) {
+			return false; // e.g if the DB is new
+		} catch (mdb::corrupted_exception&) {
+			return true; // e.g MDB_CORRUPTED or MDB_PAGE_NOTFOUND
+		}
+	}
+
+	// starts the write transaction, returns true if the DB needs to be rebuilt
+	bool begin_and_check_torn() {
+		if (invalid)
+			return true;
+		begin_write_transaction();
+		return is_torn();
+	}
+
+	void read_write_transaction() {
+		read_write_transaction([] {});
+	}
+
+	// remove_dependents is called if the DB is rebuilt, to remove the files that refer to its ids,
+	// while the users lock is held exclusively (so they should only be used while this DB is open)
+	template<typename F>
+	void read_write_transaction(F&& remove_dependents) {
+		TRACE();
+		rebuilt = false;
+		if (begin_and_check_torn())
+			rebuild(remove_dependents);
+		check_header();
+	}
+
+	// the DB is only a cache, so it's rebuilt rather than trusted
+	// other processes may have the file mapped, so it's only removed while the users lock is held exclusively
+	template<typename F>
+	void rebuild(F&& remove_dependents) {
+		TRACE();
+		close_env();
+		users_lock.unlock();
+		users_lock.lock_exclusive();
+		open_env_or_invalidate();
+		bool torn = begin_and_check_torn(); // unless another process rebuilt it while this one was waiting
+		close_env();
+		if (torn) {
+			fs::remove(fs::u8path(db_file_path));
+			// lmdb's lock file has the reader table of the old file
+			fs::remove(fs::u8path(db_file_path + "-lock"));
+			remove_dependents();
+			rebuilt = true;
+		}
+		// note: the write transaction only starts after the lock is shared again,
+		// because a process holding the exclusive lock may be waiting for the write transaction
+		users_lock.unlock();
+		users_lock.lock_shared();
+		open_env();
+		begin_write_transaction();
+	}
+
+	void check_header() {
+		auto dbi = txn_rw.open_db<uint64_t, db_header>("header");
+		db_header h;
+		try {
+			h = dbi.get(1);
+		} catch (mdb::key_not_found_exception&) {
+			dbi.put(1, db_header {});
+		}
+		if (h.version != db_header::current_version)
+			throw std::runtime_error("db version mismatch");
+	}
+
+	std::size_t get_last_page_number() {
+		return env.info().me_last_pgno;
+	}
+
+	void commit_transaction() {
+		TRACE();
+		// note: unless the durability is FULL, a system crash may undo this commit, or tear the DB (see is_torn)
+		txn_rw.open_db<uint64_t, db_epoch>("header").put(2,
+			db_epoch { txn_rw.id(), durability != Scanner::Durability::FULL });
+		txn_rw.commit();
+		end_write_transaction();
+		TRACE_COUNTER("db pages used", env.info().me_last_pgno + 1);
+	}
+
+	// calls write_changes and commits, if the map is full then it grows and this is retried in a new transaction
+	// note: so write_changes must not depend on any data read from the DB in the current transaction
+	// note: the writers lock is kept meanwhile, so the new transaction still sees what was read in the aborted one
+	template<typename F>
+	void write_and_commit(F&& write_changes) {
+		while (true) {
+			try {
+				write_changes();
+				commit_transaction();
+				return;
+			} catch (mdb::map_full_exception&) {
+				txn_rw = {}; // abort, the map can't grow while there's a transaction
+				grow_map();
+				txn_rw = env.txn_read_write();
+				check_header();
+			}
+		}
+	}
+
+	// rewrites the DB file without the free pages
+	// other processes may have the old file mapped, so it's only replaced while the users lock is held exclusively
+	// note: the DB is closed after this
+	void compact() {
+		TRACE();
+		close_env();
+		users_lock.unlock();
+		users_lock.lock_exclusive();
+		open_env();
+		// the compacted copy may restart the transaction ids, so a dirty epoch (see is_torn) wouldn't match them
+		// and the DB would be rebuilt on the next open, but the copy is complete anyway so the epoch is made clean
+		txn_rw = env.txn_read_write();
+		txn_rw.open_db<uint64_t, db_epoch>("header").put(2, db_epoch { txn_rw.id(), false });
+		txn_rw.commit();
+		std::string compact_path = db_file_path + ".compact";
+		fs::remove(fs::u8path(compact_path));
+		env.copy(compact_path.c_str(), true);
+		close_env();
+		fs::rename(fs::u8path(compact_path), fs::u8path(db_file_path));
+		// lmdb's lock file has the reader table of the old file
+		fs::remove(fs::u8path(db_file_path + "-lock"));
+		users_lock.close();
+	}
+};
+
+// the scanner's persistent state
+struct DB : public db_env {
+	struct file_entry {
+		file_time_t last_write_time;
+	};
+
+	mdb::string_id_store<db_target_id> target_store { "targets" };
+	mdb::path_id_store<file_id_t> path_store { "paths" };
+	mdb::id_store<file_id_t, file_entry> file_data_store { "file_data" };
+	mdb::string_id_store<module_id_t> module_store { "modules" };
+
+	// in partitioned mode (see Scanner::ConfigBase::partitioned_db) env / txn_rw only have the items
+	// (and the minimized sources) of the scanned targets, and the stores above are in the shared env,
+	// which is only read from a snapshot while scanning and the new paths/modules are merged into it at the end
+	bool partitioned = false;
+	db_env shared;
+	mdb::mdb_txn_ro shared_txn_ro;
+
+	// calls f with the transaction that the stores should be read with
+	template<typename F>
+	decltype(auto) with_shared_txn(F&& f) {
+		if (partitioned)
+			return f(shared_txn_ro);
+		return f(txn_rw);
+	}
+
+	static constexpr std::string_view shared_db_file_name = "scanner.mdb";
+	static constexpr std::string_view partition_prefix = "scanner.items.";
+
+	// the items of a given set of targets are always in the same partition
+	static std::string get_partition_file_name(span_map<target_idx_t, const db_target_id> target_ids) {
+		std::vector<uint32_t> ids;
+		for (auto id : target_ids)
+			ids.push_back((uint32_t)id);
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		if (ids.size() == 1)
+			return fmt::format("{}{}.mdb", partition_prefix, ids[0]);
+		std::string key;
+		for (auto id : ids)
+			key += fmt::format("{},", id);
+		return fmt::format("{}{:016x}.mdb", partition_prefix, (uint64_t)std::hash<std::string_view>{}(key));
+	}
+
+	static std::vector<fs::path> get_partition_files(std::string_view db_path) {
+		std::vector<fs::path> files;
+		std::error_code ec;
+		for (auto& entry : fs::directory_iterator(fs::u8path(db_path), ec)) {
+			auto name = entry.path().filename().string();
+			if (name.compare(0, partition_prefix.size(), partition_prefix) == 0)
+				files.push_back(entry.path()); // including the lock files
+		}
+		return files;
+	}
+
+	// opens the shared env and adds the targets to it in a short transaction,
+	// then opens the partition with the items of these targets, returns the target ids
+	// note: the snapshot of the shared env is taken by read_write_transaction
+	vector_map<target_idx_t, db_target_id> open_partitioned(std::string_view db_path,
+		span_map<target_idx_t, std::string_view> targets,
+		Scanner::Durability durability = Scanner::Durability::FULL, std::size_t expected_nr_items = 0)
+	{
+		TRACE();
+		partitioned = true;
+		shared.open(db_path, shared_db_file_name, durability, expected_nr_items);
+		// the item ids in the partitions refer to the old paths/modules/targets
+		// note: the partitions are only used while the shared env is open, so none of them are open during the rebuild
+		shared.read_write_transaction([&] {
+			for (auto& file : get_partition_files(db_path))
+				fs::remove(file);
+		});
+		auto target_ids = target_store.get_ids(shared.txn_rw, targets);
+		shared.write_and_commit([&] {
+			// the stores need to exist in the shared env to be opened in a read-only transaction
+			path_store.open_db(shared.txn_rw);
+			module_store.open_db(shared.txn_rw);
+			file_data_store.open_db(shared.txn_rw);
+			target_store.commit_changes(shared.txn_rw);
+		});
+		// the target names read in the write transaction are no longer valid
+		target_store = mdb::string_id_store<db_target_id> { target_store.db_name };
+
+		open(db_path, get_partition_file_name(target_ids), durability, expected_nr_items);
+		return target_ids;
+	}
+
+	void read_write_transaction() {
+		db_env::read_write_transaction();
+		// a concurrent scan of the same targets may have added items to the partition with ids that it added
+		// to the shared env, so the snapshot is only taken once the partition's write lock is held
+		if (partitioned)
+			shared_txn_ro = shared.env.txn_read_only();
+	}
+
+	// the ids used by a partitioned scan for its new paths and modules, mapped to their ids in the shared env
+	struct shared_id_remap {
+		vector_map<file_id_t, file_id_t> files;
+		vector_map<module_id_t, module_id_t> modules;
+		bool changed = false; // false if all the ids map to themselves
+	};
+
+	// adds the new paths and modules to the shared env in a short transaction
+	// note: other scans may have added their own in the meantime, so the new ids may change
+	// note: the views into the snapshot of the shared env are invalid after this
+	shared_id_remap merge_shared_stores() {
+		TRACE();
+		shared_id_remap remap;
+		remap.files.resize(path_store.next_id);
+		for (auto id : remap.files.indices())
+			remap.files[id] = id;
+		remap.modules.resize(module_store.next_id);
+		for (auto id : remap.modules.indices())
+			remap.modules[id] = id;
+		bool new_paths = (path_store.next_id != path_store.db_max_id + 1);
+		bool new_modules = (module_store.is_initialized && module_store.next_id != module_store.db_max_id + 1);
+		shared_txn_ro = {};
+		if (!new_paths && !new_modules)
+			return remap;
+
+		shared.read_write_transaction();
+		mdb::path_id_store<file_id_t> merged_paths { path_store.db_name };
+		merged_paths.read_paths(shared.txn_rw, "");
+		for (auto id = path_store.db_max_id + 1; id < path_store.next_id; ++id)
+			remap.files[id] = merged_paths.try_add(path_store.get_file_path(id));
+		// note: the new module names are views into the scanner's output, so they're still valid
+		mdb::string_id_store<module_id_t> merged_modules { module_store.db_name };
+		merged_modules.init(shared.txn_rw, {});
+		if (new_modules)
+			for (auto id = module_store.db_max_id + 1; id < module_store.next_id; ++id)
+				remap.modules[id] = merged_modules.try_add(module_store.get(id));
+		shared.write_and_commit([&] {
+			merged_paths.commit_changes(shared.txn_rw);
+			merged_modules.commit_changes(shared.txn_rw);
+		});
+
+		for (auto id : remap.files.indices())
+			remap.changed |= (remap.files[id] != id);
+		for (auto id : remap.modules.indices())
+			remap.changed |= (remap.modules[id] != id);
+		return remap;
+	}
+
+	auto get_item_file_ids(std::string_view item_root_path, span_map<scan_item_idx_t, const ScanItemView> items)
+	{
+		TRACE();
+		vector_map<scan_item_idx_t, std::string_view> paths;
+		paths.reserve(items.size());
+		for (auto& item : items)
+			paths.push_back(item.path);
+		return with_shared_txn([&](auto& txn) {
+			return path_store.get_file_ids(txn, item_root_path, paths);
+		});
+	}
+
+	template<typename size_type, typename... Vs>
+	static void resize_all_to(size_type size, Vs&&... vs) {
+		(vs.resize(size), ...);
+	}
+
+	auto get_target_ids(span_map<target_idx_t, std::string_view> targets) {
+		TRACE();
+		return with_shared_txn([&](auto& txn) {
+			return target_store.get_ids(txn, targets);
+		});
+	}
+
+	struct item_entry {
+		cmd_hash_t cmd_hash;
+		file_time_t last_successful_scan;
+		tcb::span<file_id_t> file_deps;
+		tcb::span<item_id_t> item_deps;
+		module_id_t exports;
+		tcb::span<module_id_t> imports;
+	};
+
+	// todo: make the DB independent of particular strong indexes used by the caller   
+	struct item_data {
+		// the source file corresponding to a given item (if it changes, the item is out of date)
+		vector_map<scan_item_idx_t, file_id_t> file_id;
+		vector_map<scan_item_idx_t, cmd_hash_t> cmd_hash;
+		vector_map<scan_item_idx_t, file_time_t> last_successful_scan;
+		// for a given item: if any of the files in file_deps changed then the item is out of date
+		vector_map<scan_item_idx_t, tcb::span<file_id_t>> file_deps;
+		// for a given item: if any of the items in item_deps are out of date then the item is out of date as well
+		// note: this works recursively so that for e.g importable header units we can compress the log more
+		vector_map<scan_item_idx_t, tcb::span<item_id_t>> item_deps;
+		// note: the deps are invalidated on the first mdb_put operation
+		// "Values returned from the database are valid only until a subsequent update operation, or the end of the transaction."
+		file_id_t db_max_file_id = {}; // the largest file id in the database + 1
+		file_id_t max_file_id = {}; // includes new files not already in the database
+		vector_map<scan_item_idx_t, module_id_t> exports;
+		vector_map<scan_item_idx_t, tcb::span<module_id_t>> imports;
+		module_id_t db_max_module_id = {}; // the largest module id the database + 1
+
+		void resize(scan_item_idx_t size) {
+			TRACE();
+			DB::resize_all_to(size, file_id, cmd_hash, last_successful_scan, file_deps, item_deps, exports, imports);
+		}
+	};
+	auto get_item_data(span_map<scan_item_idx_t, const db_target_id> item_target_ids, std::string_view item_root_path,
+		span_map<scan_item_idx_t, const ScanItemView> items) 
+	{
+		item_data data;
+		data.resize(items.size()); // todo: can we not allocate all this if the DB is empty ?
+
+		data.file_id = get_item_file_ids(item_root_path, items);
+		data.db_max_file_id = path_store.db_max_id + 1; // todo: this is terrible
+		data.max_file_id = path_store.next_id;
+
+		TRACE(); // the resize and the get_item_file_ids are measured separately
+		// todo: maybe make file_id the key and allow duplicates >
+		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
+
+		// only the items of files that were already in the DB can have history
+		std::vector<scan_item_idx_t> lookup_items;
+		std::vector<item_id_t> lookup_keys;
+		for (auto i : items.indices()) {
+			auto file_id = data.file_id[i];
+			if (file_id >= data.db_max_file_id) // nothing to do here for new files
+				continue;
+			lookup_items.push_back(i);
+			lookup_keys.push_back({ file_id, item_target_ids[i] });
+		}
+
+		db.get_many(lookup_keys, [&](std::size_t lookup_idx, auto entry) {
+			// if e.g the scanner was interrupted/crashed then
+			// the file may be in the DB but not the item, ignore this
+			if (!entry)
+				return;
+			auto i = lookup_items[lookup_idx];
+			// what about data.target ?
+			data.cmd_hash[i] = entry->cmd_hash;
+			data.last_successful_scan[i] = entry->last_successful_scan;
+			data.file_deps[i] = entry->file_deps;
+			data.item_deps[i] = entry->item_deps;
+			data.exports[i] = entry->exports;
+			data.imports[i] = entry->imports;
+		});
+		return data;
+	}
+
+	// true if the DB has no history, e.g if it was just created
+	bool has_no_items() {
+		return txn_rw.open_db<item_id_t, item_entry>("items").size() == 0;
+	}
+
+	// same as get_item_data but when there's no history, so only the item file ids need to be looked up
+	auto get_new_item_data(std::string_view item_root_path, span_map<scan_item_idx_t, const ScanItemView> items)
+	{
+		item_data data;
+		data.resize(items.size());
+		data.file_id = get_item_file_ids(item_root_path, items);
+		data.db_max_file_id = path_store.db_max_id + 1;
+		data.max_file_id = path_store.next_id;
+		return data;
+	}
+
+	// the items entries serialized as they come in from the scanner,
+	// so that writing them to the DB later only needs to copy the bytes
+	struct item_write_batch {
+		struct staged_item {
+			item_id_t key;
+			std::size_t ofs;
+			std::size_t size;
+		};
+		std::vector<staged_item> staged;
+		std::vector<char> values;
+
+		void add(item_id_t key, const item_entry& entry) {
+			std::size_t size = mdb::impl::get_val_size(entry);
+			std::size_t ofs = values.size();
+			values.resize(ofs + size);
+			mdb::impl::to_val<false>(entry, values.data() + ofs, (int)size);
+			staged.push_back({ key, ofs, size });
+		}
+
+		// same as add but with all the ids in the key and the entry replaced by their new_*_ids
+		template<typename FileIds, typename TargetIds, typename ModuleIds>
+		void add_remapped(item_id_t key, const item_entry& entry,
+			const FileIds& new_file_ids, const TargetIds& new_target_ids, const ModuleIds& new_module_ids)
+		{
+			file_deps_buf.clear();
+			for (auto file_id : entry.file_deps)
+				file_deps_buf.push_back(new_file_ids[file_id]);
+			item_deps_buf.clear();
+			for (auto item_id : entry.item_deps)
+				item_deps_buf.push_back({ new_file_ids[item_id.file_id], new_target_ids[item_id.target_id] });
+			imports_buf.clear();
+			for (auto module_id : entry.imports)
+				imports_buf.push_back(new_module_ids[module_id]);
+			add({ new_file_ids[key.file_id], new_target_ids[key.target_id] }, item_entry {
+				entry.cmd_hash, entry.last_successful_scan, file_deps_buf, item_deps_buf,
+				new_module_ids[entry.exports], imports_buf
+			});
+		}
+
+		std::vector<file_id_t> file_deps_buf;
+		std::vector<item_id_t> item_deps_buf;
+		std::vector<module_id_t> imports_buf;
+	};
+
+	// maps the ids in the batch from the ones used while scanning to the ones in the shared env
+	static item_write_batch remap_items(const item_write_batch& batch, const shared_id_remap& remap) {
+		TRACE();
+		struct same_target {
+			db_target_id operator[](db_target_id id) const { return id; }
+		};
+		item_write_batch ret;
+		ret.values.reserve(batch.values.size());
+		for (auto& item : batch.staged) {
+			auto entry = mdb::impl::from_val<item_entry>(MDB_val { item.size, (void*)(batch.values.data() + item.ofs) });
+			ret.add_remapped(item.key, entry, remap.files, same_target {}, remap.modules);
+		}
+		return ret;
+	}
+
+	void update_items(const item_write_batch& batch)
+	{
+		TRACE();
+		if (!partitioned) { // otherwise they're merged into the shared env separately
+			module_store.commit_changes(txn_rw);
+			target_store.commit_changes(txn_rw); // todo: order matters to be able to use append ?
+			path_store.commit_changes(txn_rw);
+		}
+
+		// the values were already serialized into the item_entry format
+		auto db = txn_rw.open_db<item_id_t, std::string_view>("items");
+
+		std::vector<item_id_t> keys;
+		keys.reserve(batch.staged.size());
+		for (auto& item : batch.staged)
+			keys.push_back(item.key);
+		db.put_many_serialized(keys, [&](std::size_t idx) {
+			return batch.staged[idx].size;
+		}, [&](std::size_t idx, char* dst) {
+			auto& item = batch.staged[idx];
+			memcpy(dst, batch.values.data() + item.ofs, item.size);
+		});
+	}
+
+	void remove_items(span_map<target_idx_t, db_target_id> targets,
+		span_map<scan_item_idx_t, const ScanItemView> items,
+		const vector_map<scan_item_idx_t, file_id_t>& item_file_ids)
+	{
+		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
+
+		for (auto i : items.indices()) {
+			auto file_id = item_file_ids[i];
+			auto target_id = targets[items[i].target_idx];
+			if(target_id.is_valid())
+				db.del(item_id_t { file_id, target_id });
+		}
+	}
+
+	void print_items() {
+		auto db = txn_rw.open_db<item_id_t, item_entry>("items");
+		for (auto&& [item_id, entry] : db) {
+			fmt::print("{} - ", item_id);
+			fmt::print("hash: {} lss: {} exp: {} ",
+				entry.cmd_hash, entry.last_successful_scan, entry.exports);
+			auto print_vec = [](std::string_view name, const auto& vec) {
+				//fmt::print("{}: [{}]", name, fmt::join(vec, ", ")); // todo:
+				if (!vec.empty()) {
+					fmt::print("{}: [{}", name, vec.front());
+					for (auto&& elem : vec.subspan(1))
+						fmt::print(",{}", elem);
+					fmt::print("] ");
+				}
+			};
+			print_vec("imp", entry.imports);
+			print_vec("fdep", entry.file_deps);
+			print_vec("idep", entry.item_deps);
+			fmt::print("\n");
+		}
+	}
+
+	struct file_data {
+		// note: only used when a file tracker is keeping these values up to date
+		vector_map<unique_deps_idx_t, file_time_t> last_write_time;
+		// todo: maybe hash ? - we already need to read all the files to scan them so ..
+		void resize(unique_deps_idx_t size) {
+			DB::resize_all_to(size, last_write_time);
+		}
+	};
+	auto get_file_data(const vector_map<unique_deps_idx_t, file_id_t>& files) {
+		TRACE();
+		file_data data;
+		data.resize(files.size());
+		with_shared_txn([&](auto& txn) {
+			file_data_store.get_data(txn, files, [&](unique_deps_idx_t idx, const file_entry& f) {
+				data.last_write_time[idx] = f.last_write_time;
+			});
+		});
+		return data;
+	}
+
+	void get_file_paths(std::string_view item_root_path,
+		tcb::span<const file_id_t> deps_to_stat, 
+		/*inout:*/ vector_map<file_id_t, std::string_view>& file_paths)
+	{
+		// todo: parallelize this ?
+		for (auto dep_file_id : deps_to_stat) {
+			if (file_paths[dep_file_id].empty()) // don't use the DB if it's already set
+				file_paths[dep_file_id] = path_store.get_file_path(dep_file_id);
+		}
+	}
+
+	// the sources minimized for clang-scan-deps, for the last write time they were minimized at
+	struct minimized_entry {
+		file_time_t last_write_time;
+		std::string_view contents;
+	};
+
+	// calls f(idx, entry) for each files[idx] that has a minimized source in the DB
+	template<typename F>
+	void get_minimized_sources(tcb::span<const file_id_t> files, F&& f) {
+		TRACE();
+		auto db = txn_rw.open_db<file_id_t, minimized_entry>("minimized");
+		std::vector<std::size_t> lookup_idxs;
+		std::vector<file_id_t> lookup_keys;
+		for (std::size_t idx = 0; idx < files.size(); ++idx) {
+			if (files[idx] > path_store.db_max_id) // there's nothing to fetch for new files
+				continue;
+			lookup_idxs.push_back(idx);
+			lookup_keys.push_back(files[idx]);
+		}
+		db.get_many(lookup_keys, [&](std::size_t lookup_idx, auto entry) {
+			if (entry)
+				f(lookup_idxs[lookup_idx], *entry);
+		});
+	}
+
+	// get_entry(idx) should return an optional<minimized_entry> for files[idx]
+	template<typename F>
+	void put_minimized_sources(tcb::span<const file_id_t> files, F&& get_entry) {
+		TRACE();
+		auto db = txn_rw.open_db<file_id_t, minimized_entry>("minimized");
+		for (std::size_t idx = 0; idx < files.size(); ++idx)
+			if (std::optional<minimized_entry> entry = get_entry(idx))
+				db.put(files[idx], *entry);
+	}
+
+	// see Scanner::put_fingerprints
+	// note: these are in the items' env in partitioned mode, since they're keyed by the items
+	auto get_fingerprints(span_map<scan_item_idx_t, const item_id_t> item_ids, file_id_t db_max_file_id) {
+		TRACE();
+		vector_map<scan_item_idx_t, ItemFingerprint> fingerprints;
+		fingerprints.resize(item_ids.size());
+		auto db = txn_rw.open_db<item_id_t, ItemFingerprint>("fingerprints");
+		std::vector<scan_item_idx_t> lookup_items;
+		std::vector<item_id_t> lookup_keys;
+		for (auto i : item_ids.indices()) {
+			if (item_ids[i].file_id >= db_max_file_id) // there's nothing to fetch for new files
+				continue;
+			lookup_items.push_back(i);
+			lookup_keys.push_back(item_ids[i]);
+		}
+		db.get_many(lookup_keys, [&](std::size_t lookup_idx, auto fingerprint) {
+			if (fingerprint)
+				fingerprints[lookup_items[lookup_idx]] = *fingerprint;
+		});
+		return fingerprints;
+	}
+
+	void put_fingerprints(span_map<scan_item_idx_t, const item_id_t> item_ids,
+		span_map<scan_item_idx_t, const ItemFingerprint> fingerprints)
+	{
+		TRACE();
+		auto db = txn_rw.open_db<item_id_t, ItemFingerprint>("fingerprints");
+		std::vector<item_id_t> keys;
+		std::vector<ItemFingerprint> values;
+		for (auto i : fingerprints.indices()) {
+			if (!fingerprints[i].is_valid())
+				continue;
+			keys.push_back(item_ids[i]);
+			values.push_back(fingerprints[i]);
+		}
+		db.put_many(keys, [&](std::size_t idx) -> const ItemFingerprint& {
+			return values[idx];
+		});
+	}
+
+	// see Scanner::get_file_digests, the files with invalid ids are skipped
+	// note: like the fingerprints, these are in the items' env in partitioned mode
+	void get_file_digests(tcb::span<const file_id_t> files, tcb::span<FileDigest> digests) {
+		TRACE();
+		auto db = txn_rw.open_db<file_id_t, FileDigest>("file_digests");
+		std::vector<std::size_t> lookup_idxs;
+		std::vector<file_id_t> lookup_keys;
+		for (std::size_t idx = 0; idx < files.size(); ++idx) {
+			if (!files[idx].is_valid())
+				continue;
+			lookup_idxs.push_back(idx);
+			lookup_keys.push_back(files[idx]);
+		}
+		db.get_many(lookup_keys, [&](std::size_t lookup_idx, auto digest) {
+			if (digest)
+				digests[lookup_idxs[lookup_idx]] = *digest;
+		});
+	}
+
+	void put_file_digests(tcb::span<const file_id_t> files, tcb::span<const FileDigest> digests) {
+		TRACE();
+		auto db = txn_rw.open_db<file_id_t, FileDigest>("file_digests");
+		std::vector<file_id_t> keys;
+		std::vector<FileDigest> values;
+		for (std::size_t idx = 0; idx < files.size(); ++idx) {
+			if (!files[idx].is_valid() || !digests[idx].is_valid())
+				continue;
+			keys.push_back(files[idx]);
+			values.push_back(digests[idx]);
+		}
+		db.put_many(keys, [&](std::size_t idx) -> const FileDigest& {
+			return values[idx];
+		});
+	}
+
+	auto get_all_module_names() {
+		return with_shared_txn([&](auto& txn) -> const auto& {
+			return module_store.get_all_strings(txn);
+		});
+	}
+
+	// an upper bound, since only the pages touched by the lookups are actually read
+	std::size_t get_nr_pages_upper_bound() {
+		return txn_rw.open_db<item_id_t, item_entry>("items").nr_pages() + with_shared_txn([&](auto& txn) {
+			return path_store.open_db(txn).nr_pages() +
+				target_store.open_db(txn).nr_pages() +
+				module_store.open_db(txn).nr_pages();
+		});
+	}
+
+	// this needs to be called before using try_add_* or get_*
+	void init_stores() {
+		TRACE();
+		with_shared_txn([&](auto& txn) {
+			module_store.init(txn, {});
+		});
+	}
+
+	// note: the input string must be valid until the changes are committed later
+	module_id_t try_add_module(std::string_view name) {
+		return module_store.try_add(name);
+	}
+
+	// note: path_store always make a normalized local copy of path
+	file_id_t try_add_file(std::string_view path) {
+		return path_store.try_add(path);
+	}
+
+	std::string_view get_module_name(module_id_t id) {
+		return module_store.get(id);
+	}
+
+	// the number of ids in each of the stores after the last gc
+	struct gc_state {
+		std::size_t nr_paths = 0;
+		std::size_t nr_modules = 0;
+		std::size_t nr_targets = 0;
+	};
+
+	// true if any of the stores grew to more than growth_factor times its size after the last gc
+	// note: the first time this is called it just records the current sizes
+	bool is_gc_due(double growth_factor) {
+		constexpr std::size_t min_nr_ids = 1024; // not worth it for small DBs
+		module_store.init(txn_rw, {});
+		gc_state current {
+			(std::size_t)path_store.next_id - 1,
+			(std::size_t)module_store.next_id - 1,
+			(std::size_t)target_store.next_id - 1
+		};
+		auto dbi = txn_rw.open_db<uint64_t, gc_state>("header");
+		gc_state last;
+		try {
+			last = dbi.get(3);
+		} catch (mdb::key_not_found_exception&) {
+			dbi.put(3, current);
+			return false;
+		}
+		auto grew = [&](std::size_t now, std::size_t then) {
+			return now >= min_nr_ids && (double)now > growth_factor * (double)std::max<std::size_t>(then, 1);
+		};
+		return grew(current.nr_paths, last.nr_paths) || grew(current.nr_modules, last.nr_modules) ||
+			grew(current.nr_targets, last.nr_targets);
+	}
+
+	// the new ids of the files and targets after a gc, the removed ones map to the invalid id
+	struct gc_id_remap {
+		vector_map<file_id_t, file_id_t> files;
+		vector_map<db_target_id, db_target_id> targets;
+
+		item_id_t get(item_id_t id) const {
+			auto remap = [](auto& new_ids, auto id) {
+				return (id < new_ids.size()) ? new_ids[id] : decltype(id) {};
+			};
+			return { remap(files, id.file_id), remap(targets, id.target_id) };
+		}
+	};
+
+	// removes the paths, modules and targets that are no longer used by any of the items
+	// and renumbers the rest, keeping their order, so that reading the stores on each scan is faster
+	// note: the minimized sources are removed as well, because the files are named after the file ids
+	// note: this assumes that no other process is using the DB
+	// returns the new ids, e.g for the item ids that were read before this
+	gc_id_remap remove_unused_ids(GcStats& stats) {
+		TRACE();
+		path_store.read_paths(txn_rw, "");
+		module_store.is_initialized = false;
+		module_store.init(txn_rw, {});
+		target_store.is_initialized = false;
+		target_store.init(txn_rw, {});
+		stats.paths_before = (std::size_t)path_store.db_max_id;
+		stats.modules_before = (std::size_t)module_store.db_max_id;
+		stats.targets_before = (std::size_t)target_store.db_max_id;
+
+		// mark the ids used by the items, with any valid id
+		vector_map<file_id_t, file_id_t> new_file_ids;
+		vector_map<db_target_id, db_target_id> new_target_ids;
+		vector_map<module_id_t, module_id_t> new_module_ids;
+		new_file_ids.resize(path_store.db_max_id + 1);
+		new_target_ids.resize(target_store.db_max_id + 1);
+		new_module_ids.resize(module_store.db_max_id + 1);
+		auto mark = [](auto& new_ids, auto id) {
+			if (!id.is_valid())
+				return;
+			if (id >= new_ids.size()) // shouldn't happen unless the DB is inconsistent
+				new_ids.resize(id + 1);
+			new_ids[id] = id;
+		};
+		auto items_db = txn_rw.open_db<item_id_t, item_entry>("items");
+		for (auto&& [id, entry] : items_db) {
+			mark(new_file_ids, id.file_id);
+			mark(new_target_ids, id.target_id);
+			for (auto file_id : entry.file_deps)
+				mark(new_file_ids, file_id);
+			for (auto item_id : entry.item_deps) {
+				mark(new_file_ids, item_id.file_id);
+				mark(new_target_ids, item_id.target_id);
+			}
+			mark(new_module_ids, entry.exports);
+			for (auto module_id : entry.imports)
+				mark(new_module_ids, module_id);
+		}
+
+		// sweep: the marked ids are renumbered consecutively, the rest stay invalid
+		auto renumber = [](auto& new_ids) {
+			std::remove_reference_t<decltype(new_ids.front())> next_id {}; // 0 is the invalid id for all of these
+			for (auto& new_id : new_ids)
+				if (new_id.is_valid())
+					new_id = ++next_id;
+			return (std::size_t)next_id;
+		};
+		stats.paths_after = renumber(new_file_ids);
+		stats.targets_after = renumber(new_target_ids);
+		stats.modules_after = renumber(new_module_ids);
+
+		// copy everything that's kept out of the DB before changing it
+		std::vector<std::string> module_names, target_names;
+		module_names.reserve(stats.modules_after);
+		target_names.reserve(stats.targets_after);
+		for (auto id : new_module_ids.indices())
+			if (new_module_ids[id].is_valid())
+				module_names.push_back((std::string)module_store.get(id));
+		for (auto id : new_target_ids.indices())
+			if (new_target_ids[id].is_valid())
+				target_names.push_back((std::string)target_store.get(id));
+		// the paths are already copied by read_paths
+		mdb::path_id_store<file_id_t> new_path_store { path_store.db_name };
+		for (auto id : new_file_ids.indices())
+			if (new_file_ids[id].is_valid())
+				new_path_store.try_add(path_store.get_file_path(id));
+
+		item_write_batch items;
+		for (auto&& [id, entry] : items_db)
+			items.add_remapped(id, entry, new_file_ids, new_target_ids, new_module_ids);
+		stats.items = items.staged.size();
+
+		std::vector<std::pair<file_id_t, file_entry>> file_data;
+		auto file_data_db = file_data_store.open_db(txn_rw);
+		for (auto&& [id, entry] : file_data_db)
+			if (id < new_file_ids.size() && new_file_ids[id].is_valid())
+				file_data.push_back({ new_file_ids[id], entry });
+
+		// rewrite everything with the new ids
+		items_db.clear();
+		auto items_raw_db = txn_rw.open_db<item_id_t, std::string_view>("items");
+		for (auto& item : items.staged)
+			items_raw_db.put(item.key, std::string_view { items.values.data() + item.ofs, item.size });
+
+		file_data_db.clear();
+		for (auto& [id, entry] : file_data)
+			file_data_db.put(id, entry);
+
+		txn_rw.open_db<file_id_t, minimized_entry>("minimized").clear();
+		txn_rw.open_db<item_id_t, ItemFingerprint>("fingerprints").clear(); // keyed by the old ids
+		txn_rw.open_db<file_id_t, FileDigest>("file_digests").clear();
+
+		path_store.open_db(txn_rw).clear();
+		new_path_store.commit_changes(txn_rw);
+
+		auto rewrite_strings = [&](auto& store, const std::vector<std::string>& strings) {
+			store.open_db(txn_rw).clear();
+			std::remove_reference_t<decltype(store)> new_store { store.db_name };
+			new_store.init(txn_rw, {});
+			for (auto& str : strings)
+				new_store.try_add(str);
+			new_store.commit_changes(txn_rw);
+		};
+		rewrite_strings(module_store, module_names);
+		rewrite_strings(target_store, target_names);
+
+		txn_rw.open_db<uint64_t, gc_state>("header").put(3,
+			gc_state { stats.paths_after, stats.modules_after, stats.targets_after });
+		return { std::move(new_file_ids), std::move(new_target_ids) };
+	}
+};
+
+} // namespace cppm
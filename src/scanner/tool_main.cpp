@@ -1,12 +1,18 @@
 #include <string_view>
 #include <string>
 #include <filesystem>
+#include <iterator>
 
 #include <fmt/core.h>
 #include <clara.hpp>
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <iostream>
 
 #include "cmd_line_utils.h"
 #include "gen_ninja.h"
+#include "gcc_module_mapper.h"
+#include "bmi_cache.h"
 
 namespace fs = std::filesystem;
 
@@ -16,7 +22,92 @@ auto config_command_line_opts(cppm::Scanner::Config& c) {
 		Opt(c.tool_path, "tool path")["--tool_path"]("default: " + c.tool_path) |
 		Opt(c.db_path, "db path")["--db_path"] |
 		Opt(c.int_dir, "int dir")["--int_dir"] |
-		Opt(c.item_set.item_root_path, "item root path")["--item_root_path"];
+		Opt(c.item_set.item_root_path, "item root path")["--item_root_path"] |
+		Opt(c.cache_minimized_sources)["--cache_minimized_sources"]("keep the minimized sources in the DB for rescans") |
+		Opt([&](std::string durability) {
+			using Durability = cppm::Scanner::Durability;
+			if (durability == "full") c.durability = Durability::FULL;
+			else if (durability == "no_meta_sync") c.durability = Durability::NO_META_SYNC;
+			else if (durability == "async") c.durability = Durability::ASYNC;
+			else return ParserResult::runtimeError("unknown durability '" + durability + "'");
+			return ParserResult::ok(ParseResultType::Matched);
+		}, "full|no_meta_sync|async")["--durability"]("how much to sync the DB on commit, default: full") |
+		Opt(c.auto_gc_growth, "factor")["--auto_gc"]("gc the DB after a scan when its stores grew this many times since the last gc") |
+		Opt(c.partitioned_db)["--partitioned_db"]("keep the items of each target in their own DB file, for concurrent scans");
+}
+
+void write_stats_json(const std::string& path, const cppm::ScanStats& stats) {
+	// in the same order as cppm::ood_state
+	constexpr const char* ood_state_names[] = { "unknown", "command_changed", "new_file",
+		"file_changed", "deps_changed", "item_deps_changed", "up_to_date" };
+	static_assert(std::size(ood_state_names) == std::tuple_size_v<decltype(stats.items_by_ood_state)>);
+	auto items = nlohmann::json::object();
+	for (std::size_t i = 0; i < stats.items_by_ood_state.size(); ++i)
+		items[ood_state_names[i]] = stats.items_by_ood_state[i];
+	nlohmann::json json = {
+		{ "items_by_ood_state", std::move(items) },
+		{ "files_stated", stats.files_stated },
+		{ "stat_time_us", stats.stat_time_us },
+		{ "db_pages_upper_bound", stats.db_pages_upper_bound },
+		{ "db_pages_written", stats.db_pages_written },
+		{ "scanner_wall_time_us", stats.scanner_wall_time_us },
+		{ "tool_output_bytes_parsed", stats.tool_output_bytes_parsed },
+		{ "new_paths", stats.new_paths },
+		{ "new_modules", stats.new_modules },
+		{ "db_map_growths", stats.db_map_growths },
+		{ "db_rebuilt", stats.db_rebuilt },
+		{ "db_gc_ran", stats.db_gc_ran }
+	};
+	std::ofstream fout(path);
+	if (!fout)
+		throw std::runtime_error(fmt::format("failed to open '{}'", path));
+	fout << json.dump(1, '\t') << "\n";
+}
+
+int gc(const cppm::Scanner::Config& c) {
+	std::string db_path = (c.db_path != "") ? c.db_path : c.int_dir;
+	cppm::Scanner scanner;
+	auto stats = scanner.gc(db_path, c.int_dir);
+	fmt::print("removed {} of {} paths, {} of {} modules and {} of {} targets not used by the {} items\n",
+		stats.paths_before - stats.paths_after, stats.paths_before,
+		stats.modules_before - stats.modules_after, stats.modules_before,
+		stats.targets_before - stats.targets_after, stats.targets_before, stats.items);
+	fmt::print("the DB size went from {} KB to {} KB\n", stats.db_size_before / 1024, stats.db_size_after / 1024);
+	return 0;
+}
+
+// serves GCC's module mapper requests on stdin/stdout, GCC starts this for each TU
+int gcc_module_mapper(const std::string& mapper_file) {
+	if (mapper_file == "")
+		throw std::invalid_argument("the mapper needs a --mapper_file");
+	auto mapper = cppm::GccModuleMapper::read_file(mapper_file);
+	mapper.serve(std::cin, std::cout);
+	return 0;
+}
+
+// runs the compile command, unless its outputs can be restored from the BMI cache
+// the output of the compiler is passed through as is, since ninja parses it (e.g for /showIncludes)
+// note: without a key file (e.g for the items that don't produce a BMI) or with an empty key this just runs the command
+int cache_compile(const std::string& bmi_cache_dir, const std::string& key_file_path, const cppm::CmdArgs& compile_cmd) {
+	if (compile_cmd.arg_vec.empty())
+		throw std::invalid_argument("cache_compile needs a command after --");
+	std::error_code ec;
+	if (bmi_cache_dir == "" || key_file_path == "" || !fs::exists(key_file_path, ec))
+		return (int)cppm::run_cmd_passthrough(compile_cmd);
+	auto key_file = cppm::BmiCacheKeyFile::read(key_file_path);
+	cppm::BmiCache cache { bmi_cache_dir };
+	if (cache.restore(key_file.key, key_file.outputs))
+		return 0;
+	int ret = (int)cppm::run_cmd_passthrough(compile_cmd);
+	if (ret == 0) {
+		try {
+			cache.store(key_file.key, key_file.outputs);
+		} catch (std::exception& e) {
+			// the outputs were built anyway, they just won't be reused
+			fmt::print(stderr, "warning: {}\n", e.what());
+		}
+	}
+	return ret;
 }
 
 int main(int argc, char * argv[])
@@ -28,15 +119,31 @@ int main(int argc, char * argv[])
 	std::string command;
 	std::string working_dir;
 	std::string comp_db_path;
+	std::string stats_json_path;
+	std::string mapper_file;
+	std::string cache_key_file;
+	cppm::CmdArgs compile_cmd;
 	cppm::Scanner::Config scanner_config;
+	cppm::ScanStats scan_stats;
 
 	auto cli = Arg(command, "command") |
 		Opt(working_dir, "change to this directory before proceeding")["--working_dir"] |
 		Opt(comp_db_path, "compilation database path")["--comp_db_path"] |
+		Opt(stats_json_path, "write statistics about the scan to this path")["--stats_json"]["--stats-json"] |
+		Opt(mapper_file, "the modules and BMIs for the GCC module mapper")["--mapper_file"] |
+		Opt(cache_key_file, "the BMI cache key and the outputs to cache for cache_compile")["--cache_key_file"] |
 		config_command_line_opts(scanner_config) |
 		gen_ninja.command_line_opts();
 
 	auto result = cppm::apply_command_line_from_file(argc, argv, [&](int argc, char* argv[]) {
+		// everything after a -- is the command to run for cache_compile
+		for (int i = 1; i < argc; ++i) {
+			if (std::string_view { argv[i] } == "--") {
+				compile_cmd.arg_vec.assign(argv + i + 1, argv + argc);
+				argc = i;
+				break;
+			}
+		}
 		return cli.parse(Args(argc, argv));
 	});
 	if (!result) {
@@ -47,13 +154,25 @@ int main(int argc, char * argv[])
 	if (working_dir != "")
 		fs::current_path(working_dir);
 
+	if (stats_json_path != "")
+		scanner_config.stats = &scan_stats;
+
 	try {
-		if (command == "scan")
-			return gen_ninja.scan(comp_db_path, scanner_config);
-		else if (command == "gen_dynamic")
+		if (command == "scan") {
+			int ret = gen_ninja.scan(comp_db_path, scanner_config);
+			if (stats_json_path != "")
+				write_stats_json(stats_json_path, scan_stats);
+			return ret;
+		} else if (command == "gen_dynamic")
 			return gen_ninja.gen_dynamic(comp_db_path, scanner_config);
 		else if (command == "gen_static")
-			return gen_ninja.gen_static();
+			return gen_ninja.gen_static(comp_db_path, scanner_config);
+		else if (command == "gc")
+			return gc(scanner_config);
+		else if (command == "mapper")
+			return gcc_module_mapper(mapper_file);
+		else if (command == "cache_compile")
+			return cache_compile(gen_ninja.bmi_cache_dir, cache_key_file, compile_cmd);
 		fmt::print(stderr, "invalid command '{}'\n", command);
 	} catch (std::exception & e) {
 		fmt::print(stderr, "caught exception: {}\n", e.what());
@@ -0,0 +1,193 @@
+#include "trace.h"
+
+#include <fmt/format.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace cppm::trace {
+
+namespace {
+
+const char* get_trace_env() {
+	return std::getenv("CPPM_TRACE");
+}
+
+int get_pid() {
+#ifdef _WIN32
+	return _getpid();
+#else
+	return (int)getpid();
+#endif
+}
+
+// e.g trace.json -> trace.1234.json, since a build runs the tool many times, often concurrently
+std::string get_trace_path() {
+	const char* env = get_trace_env();
+	if (!env || !*env)
+		return "";
+	auto path = std::filesystem::u8path(env);
+	auto ext = path.extension();
+	path.replace_extension();
+	path += fmt::format(".{}", get_pid());
+	path += ext;
+	return path.u8string();
+}
+
+using clock = std::chrono::steady_clock;
+
+struct event {
+	const char* name;
+	int64_t ts_ns; // since the tracer started
+	int64_t value; // only for counters
+	char phase; // as in the chrome trace format: 'B'egin, 'E'nd or 'C'ounter
+};
+
+// each thread records into its own buffer so that recording doesn't need any locks,
+// when a buffer is full the oldest events are overwritten
+struct thread_buffer {
+	static constexpr std::size_t capacity = 1 << 14;
+	uint32_t thread_id = 0;
+	std::vector<event> events;
+	std::size_t nr_recorded = 0;
+
+	void add(const event& e) {
+		if (events.size() < capacity)
+			events.push_back(e);
+		else
+			events[nr_recorded % capacity] = e;
+		++nr_recorded;
+	}
+
+	// oldest first
+	template<typename F>
+	void for_each(F&& f) const {
+		std::size_t first = (nr_recorded > capacity) ? nr_recorded % capacity : 0;
+		for (std::size_t i = 0; i < events.size(); ++i)
+			f(events[(first + i) % events.size()]);
+	}
+};
+
+struct tracer {
+	std::string path = get_trace_path();
+	int pid = get_pid(); // so that the traces of different processes can be loaded together
+	clock::time_point start = clock::now();
+	std::mutex buffers_mutex;
+	// the buffers are shared so that they outlive the threads that recorded them
+	std::vector<std::shared_ptr<thread_buffer>> buffers;
+
+	~tracer() {
+		write_json();
+	}
+
+	thread_buffer& get_thread_buffer() {
+		thread_local std::shared_ptr<thread_buffer> buffer;
+		if (!buffer) {
+			buffer = std::make_shared<thread_buffer>();
+			std::lock_guard lock { buffers_mutex };
+			buffer->thread_id = (uint32_t)buffers.size();
+			buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	void record(const char* name, char phase, int64_t value = 0) {
+		int64_t ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+		get_thread_buffer().add({ name, ts_ns, value, phase });
+	}
+
+	static std::string escape(const char* name) {
+		std::string ret;
+		for (const char* c = name; *c; ++c) {
+			if (*c == '"' || *c == '\\')
+				ret += '\\';
+			ret += *c;
+		}
+		return ret;
+	}
+
+	void write_json() {
+		if (path.empty())
+			return;
+		std::FILE* f = std::fopen(path.c_str(), "w");
+		if (!f) {
+			fmt::print(stderr, "failed to write the trace to '{}'\n", path);
+			return;
+		}
+		fmt::print(f, "{{\"traceEvents\":[\n");
+		bool first = true;
+		auto separator = [&] {
+			const char* ret = first ? "" : ",\n";
+			first = false;
+			return ret;
+		};
+		std::lock_guard lock { buffers_mutex };
+		for (auto& buffer : buffers) {
+			fmt::print(f, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+				separator(), pid, buffer->thread_id, buffer->thread_id);
+			buffer->for_each([&](const event& e) {
+				// the timestamps are in microseconds
+				fmt::print(f, "{}{{\"name\":\"{}\",\"ph\":\"{}\",\"pid\":{},\"tid\":{},\"ts\":{}.{:03}",
+					separator(), escape(e.name), e.phase, pid, buffer->thread_id, e.ts_ns / 1000, e.ts_ns % 1000);
+				if (e.phase == 'C')
+					fmt::print(f, ",\"args\":{{\"value\":{}}}", e.value);
+				fmt::print(f, "}}");
+			});
+		}
+		fmt::print(f, "\n],\"displayTimeUnit\":\"ns\"}}\n");
+		std::fclose(f);
+	}
+};
+
+tracer& get_tracer() {
+	static tracer t;
+	return t;
+}
+
+} // namespace
+
+// -1 until the environment is read, this doesn't need a dynamic initializer
+// so it's valid even when it's used from the static initializers of other translation units
+static std::atomic<int> enabled_state { -1 };
+
+bool enabled() {
+	int state = enabled_state.load(std::memory_order_relaxed);
+	if (state < 0) {
+		const char* env = get_trace_env();
+		state = (env && *env) ? 1 : 0;
+		enabled_state.store(state, std::memory_order_relaxed);
+	}
+	return state != 0;
+}
+
+void begin(const char* name) {
+	get_tracer().record(name, 'B');
+}
+
+void end(const char* name) {
+	get_tracer().record(name, 'E');
+}
+
+void counter(const char* name, int64_t value) {
+	get_tracer().record(name, 'C', value);
+}
+
+void write() {
+	if (enabled())
+		get_tracer().write_json();
+}
+
+} // namespace cppm::trace
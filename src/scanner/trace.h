@@ -1,46 +1,35 @@
 #pragma once
 
-#if 1
-#include <fmt/core.h>
-#include <chrono>
-struct trace_func_guard {
-	const char* name;
-	using clock = std::chrono::high_resolution_clock;
-	clock::time_point start;
-	trace_func_guard(const char* name) : name(name) {
-		start = clock::now();
-	}
-	~trace_func_guard() {
-		auto end = clock::now();
-		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		if (elapsed == 0)
-			return;
-		fmt::print("{:>50} {:>5} ms\n", name, elapsed);
-	}
-};
-#define TRACE(...) trace_func_guard __trace { __FUNCTION__ };
-#define TRACE_BLOCK(name)  trace_func_guard __trace { name };
-#endif
+#include <cstdint>
+
+namespace cppm::trace {
+
+// tracing is enabled if the CPPM_TRACE environment variable is set to a path, then the events are written
+// as a chrome trace (chrome://tracing or ui.perfetto.dev) on exit, to that path with the pid before the extension
+bool enabled();
+
+void begin(const char* name);
+void end(const char* name);
+void counter(const char* name, int64_t value);
+
+// write the events recorded so far, this happens automatically on exit
+// note: no other threads should be recording events at the same time
+void write();
 
-#if 0
-#include <fmt/core.h>
-struct trace_func_guard {
+struct scope_guard {
 	const char* name;
-	trace_func_guard(const char* name) : name(name) {
-		fmt::print("entering {}\n", name);
+	bool active;
+	scope_guard(const char* name) : name(name), active(enabled()) {
+		if (active) begin(name);
 	}
-	~trace_func_guard() {
-		fmt::print("exiting {}\n", name);
+	~scope_guard() {
+		if (active) end(name);
 	}
 };
-#define TRACE(...) trace_func_guard __trace { __FUNCTION__ };
-#define TRACE_BLOCK(name)  trace_func_guard __trace { name };
-#endif
 
-#ifndef TRACE
-#define TRACE(...)
-#endif
+} // namespace cppm::trace
 
-#ifndef TRACE_BLOCK
-#define TRACE_BLOCK(...)
-#endif
\ No newline at end of file
+// note: the names are not copied, so they should be string literals
+#define TRACE(...) cppm::trace::scope_guard __trace { __FUNCTION__ };
+#define TRACE_BLOCK(name)  cppm::trace::scope_guard __trace { name };
+#define TRACE_COUNTER(name, value) do { if (cppm::trace::enabled()) cppm::trace::counter(name, (int64_t)(value)); } while (0)
@@ -0,0 +1,211 @@
+#include <catch2/catch.hpp>
+#include "bmi_cache.h"
+#include "temp_file_test.h"
+
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+
+using namespace cppm;
+
+static std::string read_file(const fs::path& path) {
+	std::ifstream fin(path, std::ios::binary);
+	return { std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>() };
+}
+
+TEST_CASE("bmi cache keys", "[bmi_cache]") {
+	TempFileTest test;
+	test.create_files(R"(
+> a.cppm
+export module a;
+#include "h.h"
+> b.cppm
+export module b;
+import a;
+> h.h
+int f();
+> cl.exe
+compiler
+)");
+	auto path = [&](const char* file) { return (test.tmp_path / file).string(); };
+	std::string cl_cmd = fmt::format("\"{}\" /c /module:interface", path("cl.exe"));
+
+	// b imports a, c is a regular TU so it doesn't get a key
+	CollatedModuleInfo info;
+	info.imports_item_buf = { scan_item_idx_t { 0 } };
+	info.imports_item.push_back({});
+	info.imports_item.push_back({ info.imports_item_buf.data(), 1 });
+	info.imports_item.push_back({ info.imports_item_buf.data(), 1 });
+	vector_map<scan_item_idx_t, std::string> commands;
+	commands.push_back(cl_cmd);
+	commands.push_back(cl_cmd);
+	commands.push_back("");
+	vector_map<scan_item_idx_t, std::vector<std::string>> file_deps;
+	file_deps.push_back({ path("a.cppm"), path("h.h") });
+	file_deps.push_back({ path("b.cppm") });
+	file_deps.push_back({ path("b.cppm") });
+
+	auto keys = compute_bmi_cache_keys(info, commands, file_deps);
+	REQUIRE(keys.size() == scan_item_idx_t { 3 });
+	CHECK(keys[scan_item_idx_t { 0 }].size() == 32);
+	CHECK(keys[scan_item_idx_t { 1 }].size() == 32);
+	CHECK(keys[scan_item_idx_t { 0 }] != keys[scan_item_idx_t { 1 }]);
+	CHECK(keys[scan_item_idx_t { 2 }] == "");
+	CHECK(compute_bmi_cache_keys(info, commands, file_deps) == keys);
+
+	SECTION("a changed header changes the keys of the importers too") {
+		std::ofstream { test.tmp_path / "h.h" } << "int g();\n";
+		auto new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] != keys[scan_item_idx_t { 0 }]);
+		CHECK(new_keys[scan_item_idx_t { 1 }] != keys[scan_item_idx_t { 1 }]);
+	}
+
+	SECTION("the command is part of the key") {
+		commands[scan_item_idx_t { 1 }] += " /O2";
+		auto new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] == keys[scan_item_idx_t { 0 }]);
+		CHECK(new_keys[scan_item_idx_t { 1 }] != keys[scan_item_idx_t { 1 }]);
+	}
+
+	SECTION("the compiler is part of the key") {
+		std::ofstream { test.tmp_path / "cl.exe" } << "updated compiler\n";
+		auto new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] != keys[scan_item_idx_t { 0 }]);
+		CHECK(new_keys[scan_item_idx_t { 1 }] != keys[scan_item_idx_t { 1 }]);
+
+		commands[scan_item_idx_t { 0 }] = fmt::format("\"{}\" /c /module:interface", path("missing.exe"));
+		new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] == "");
+		CHECK(new_keys[scan_item_idx_t { 1 }] == "");
+	}
+
+	SECTION("missing files and cycles can't be cached") {
+		file_deps[scan_item_idx_t { 0 }].push_back(path("missing.h"));
+		auto new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] == "");
+		CHECK(new_keys[scan_item_idx_t { 1 }] == "");
+
+		std::vector<scan_item_idx_t> cycle_buf = { scan_item_idx_t { 1 } };
+		info.imports_item[scan_item_idx_t { 0 }] = { cycle_buf.data(), 1 };
+		file_deps[scan_item_idx_t { 0 }].pop_back();
+		new_keys = compute_bmi_cache_keys(info, commands, file_deps);
+		CHECK(new_keys[scan_item_idx_t { 0 }] == "");
+		CHECK(new_keys[scan_item_idx_t { 1 }] == "");
+	}
+}
+
+// a FileDigestStore that only keeps the digests in memory
+struct MemoryFileDigestStore : public FileDigestStore {
+	std::unordered_map<std::string, FileDigest> digests;
+	std::size_t nr_put = 0;
+
+	std::vector<FileDigest> get(tcb::span<const std::string_view> files) override {
+		std::vector<FileDigest> ret(files.size());
+		for (std::size_t i = 0; i < files.size(); ++i)
+			if (auto itr = digests.find((std::string)files[i]); itr != digests.end())
+				ret[i] = itr->second;
+		return ret;
+	}
+
+	void put(tcb::span<const std::string_view> files, tcb::span<const FileDigest> new_digests) override {
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			if (new_digests[i].is_valid()) {
+				digests[(std::string)files[i]] = new_digests[i];
+				nr_put++;
+			}
+		}
+	}
+};
+
+TEST_CASE("bmi cache file digest store", "[bmi_cache]") {
+	TempFileTest test;
+	test.create_files(R"(
+> a.cppm
+export module a;
+#include "h.h"
+> h.h
+int f();
+> cl.exe
+compiler
+)");
+	auto path = [&](const char* file) { return (test.tmp_path / file).string(); };
+	CollatedModuleInfo info;
+	info.imports_item.push_back({});
+	vector_map<scan_item_idx_t, std::string> commands;
+	commands.push_back(fmt::format("\"{}\" /c /module:interface", path("cl.exe")));
+	vector_map<scan_item_idx_t, std::vector<std::string>> file_deps;
+	file_deps.push_back({ path("a.cppm"), path("h.h") });
+
+	MemoryFileDigestStore store;
+	auto keys = compute_bmi_cache_keys(info, commands, file_deps, &store);
+	CHECK(keys == compute_bmi_cache_keys(info, commands, file_deps));
+	CHECK(store.digests.size() == 2);
+	CHECK(store.nr_put == 2);
+
+	// the files that weren't written since aren't read again
+	CHECK(compute_bmi_cache_keys(info, commands, file_deps, &store) == keys);
+	CHECK(store.nr_put == 2);
+
+	auto h_path = fs::path { path("h.h") };
+	auto lwt = fs::last_write_time(h_path);
+	std::ofstream { h_path } << "int g();\n";
+	fs::last_write_time(h_path, lwt);
+	CHECK(compute_bmi_cache_keys(info, commands, file_deps, &store) == keys);
+	CHECK(store.nr_put == 2);
+
+	fs::last_write_time(h_path, lwt + std::chrono::seconds(1));
+	CHECK(compute_bmi_cache_keys(info, commands, file_deps, &store) != keys);
+	CHECK(store.nr_put == 3);
+}
+
+TEST_CASE("bmi cache compiler identity", "[bmi_cache]") {
+	TempFileTest test;
+	test.create_files(R"(
+> cl.exe
+compiler
+)");
+	auto cl_path = (test.tmp_path / "cl.exe").string();
+	auto identity = get_compiler_identity(fmt::format("\"{}\" /c", cl_path));
+	CHECK(identity != "");
+	CHECK(get_compiler_identity(fmt::format("{} /c", cl_path)) == identity);
+	CHECK(get_compiler_identity(fmt::format("\"{}\" /c", (test.tmp_path / "missing.exe").string())) == "");
+}
+
+TEST_CASE("bmi cache normalize command", "[bmi_cache]") {
+	CHECK(normalize_command("  cl.exe   /c\t/Fo\"a  b.obj\"  ") == "cl.exe /c /Fo\"a  b.obj\"");
+	CHECK(normalize_command("cl.exe /c") == normalize_command("cl.exe  /c"));
+}
+
+TEST_CASE("bmi cache store and restore", "[bmi_cache]") {
+	TempFileTest test;
+	test.create_files(R"(
+> a.obj
+obj
+> a.ifc
+ifc
+)");
+	test.create_dir("cache");
+	BmiCache cache { (test.tmp_path / "cache").string() };
+	std::vector<std::string> outputs = { (test.tmp_path / "a.obj").string(), (test.tmp_path / "a.ifc").string() };
+	std::string key = "0123456789abcdef0123456789abcdef";
+
+	CHECK(!cache.restore(key, outputs));
+	cache.store(key, outputs);
+	fs::remove(outputs[0]);
+	std::ofstream { outputs[1] } << "changed\n";
+	REQUIRE(cache.restore(key, outputs));
+	CHECK(read_file(outputs[0]) == "obj\n");
+	CHECK(read_file(outputs[1]) == "ifc\n");
+	CHECK(!cache.restore("", outputs));
+
+	SECTION("key files") {
+		test.all_files_created.insert("a.cachekey");
+		auto key_file_path = (test.tmp_path / "a.cachekey").string();
+		BmiCacheKeyFile key_file { key, outputs };
+		std::ofstream { key_file_path } << key_file.to_string();
+		auto read_key_file = BmiCacheKeyFile::read(key_file_path);
+		CHECK(read_key_file.key == key);
+		CHECK(read_key_file.outputs == outputs);
+		CHECK_THROWS(BmiCacheKeyFile::read((test.tmp_path / "missing.cachekey").string()));
+	}
+}
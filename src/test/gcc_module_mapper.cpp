@@ -0,0 +1,87 @@
+#include <catch2/catch.hpp>
+#include "gcc_module_mapper.h"
+#include "temp_file_test.h"
+
+#include <sstream>
+
+TEST_CASE("gcc module mapper", "[gcc_module_mapper]") {
+	cppm::GccModuleMapper mapper;
+	mapper.module_to_bmi["a"] = "a.gcm";
+	mapper.module_to_bmi["b:part"] = "b part.gcm";
+	std::string header = (fs::current_path() / "h.h").generic_string();
+	mapper.header_unit_to_bmi[header] = "h.gcm";
+
+	SECTION("requests") {
+		CHECK(mapper.respond("HELLO 1 GCC 'a.cpp'") == "HELLO 1 cppm_scanner_tool");
+		CHECK(mapper.respond("MODULE-REPO") == "PATHNAME .");
+		CHECK(mapper.respond("MODULE-IMPORT a") == "PATHNAME a.gcm");
+		CHECK(mapper.respond("MODULE-EXPORT 'b:part'") == "PATHNAME 'b part.gcm'");
+		CHECK(mapper.respond("MODULE-COMPILED a") == "OK");
+		CHECK(mapper.respond("MODULE-IMPORT c") == "ERROR 'unknown module c'");
+		CHECK(mapper.respond("INCLUDE-TRANSLATE ./h.h") == "PATHNAME h.gcm");
+		CHECK(mapper.respond("MODULE-IMPORT ./h.h") == "PATHNAME h.gcm");
+		CHECK(mapper.respond("INCLUDE-TRANSLATE ./x.h") == "BOOL FALSE");
+		CHECK(mapper.respond("INVOKE x") == "ERROR 'unsupported request INVOKE'");
+	}
+
+	SECTION("batches") {
+		std::istringstream in { "HELLO 1 GCC ;\nMODULE-REPO ;\nMODULE-IMPORT a\nMODULE-COMPILED a\n" };
+		std::ostringstream out;
+		mapper.serve(in, out);
+		CHECK(out.str() == "HELLO 1 cppm_scanner_tool ;\nPATHNAME . ;\nPATHNAME a.gcm\nOK\n");
+	}
+
+	SECTION("mapper file") {
+		TempFileTest test;
+		test.all_files_created.insert("mapper.txt");
+		auto path = (test.tmp_path / "mapper.txt").string();
+		mapper.repo_dir = "bmis";
+		mapper.write_file(path);
+		auto read_mapper = cppm::GccModuleMapper::read_file(path);
+		CHECK(read_mapper.repo_dir == "bmis");
+		CHECK(read_mapper.module_to_bmi == mapper.module_to_bmi);
+		CHECK(read_mapper.header_unit_to_bmi == mapper.header_unit_to_bmi);
+	}
+}
+
+TEST_CASE("gcc module mapper - add modules", "[gcc_module_mapper]") {
+	cppm::ScanItemSet item_set;
+	item_set.item_root_path = fs::current_path().string();
+	item_set.commands.push_back("g++ -std=c++20");
+	item_set.targets.push_back("target");
+	auto add_item = [&](std::string path, bool is_header_unit = false) {
+		item_set.items.push_back({ std::move(path), cppm::cmd_idx_t { 0 }, cppm::target_idx_t { 0 }, is_header_unit });
+	};
+	add_item("a.cppm");
+	add_item("b.cppm");
+	add_item("h.h", true);
+	add_item("main.cpp");
+	auto owned_view = cppm::ScanItemSetOwnedView::from(item_set);
+	auto item_set_view = cppm::ScanItemSetView::from(owned_view);
+
+	cppm::CollatedModuleInfo info;
+	info.exports.push_back("a");
+	info.exports.push_back("b:part");
+	info.exports.push_back({});
+	info.exports.push_back({});
+	std::vector<std::string> bmi_files = { "a.gcm", "b-part.gcm", "h.gcm", "main.gcm" };
+
+	cppm::GccModuleMapper mapper;
+	mapper.add_modules(item_set_view, info, [&](cppm::scan_item_idx_t idx) -> std::string_view {
+		return bmi_files[(std::size_t)idx];
+	});
+	CHECK(mapper.module_to_bmi == std::unordered_map<std::string, std::string> {
+		{ "a", "a.gcm" }, { "b:part", "b-part.gcm" } });
+	REQUIRE(mapper.header_unit_to_bmi.size() == 1);
+	CHECK(mapper.respond("INCLUDE-TRANSLATE ./h.h") == "PATHNAME h.gcm");
+	CHECK(mapper.respond("INCLUDE-TRANSLATE ./main.cpp") == "BOOL FALSE");
+	CHECK(mapper.respond("MODULE-IMPORT 'b:part'") == "PATHNAME b-part.gcm");
+}
+
+TEST_CASE("gcc module mapper - mapper spec", "[gcc_module_mapper]") {
+	CHECK(cppm::GccModuleMapper::mapper_spec("/bin/tool", "/build/mapper.txt") ==
+		"|/bin/tool mapper --mapper_file=/build/mapper.txt");
+	// GCC can't split these correctly, so it reads the file itself
+	CHECK(cppm::GccModuleMapper::mapper_spec("/my tools/tool", "/build/mapper.txt") == "/build/mapper.txt");
+	CHECK(cppm::GccModuleMapper::mapper_spec("/bin/tool", "/my build/mapper.txt") == "/my build/mapper.txt");
+}
@@ -35,8 +35,8 @@ void generate_ninja(Compiler compiler = Compiler::msvc) {
 	REQUIRE(0 == run_cmd(gen_cmd));
 }
 
-void generate_ninja_from_compilation_database() {
-	cppm::CmdArgs tool_gen_cmd { "{} gen_dynamic --tool_path=\"{}\"", scanner_tool_path, clang_scan_deps_path };
+void generate_ninja_from_compilation_database(std::string_view extra_args = "", std::string_view command = "gen_dynamic") {
+	cppm::CmdArgs tool_gen_cmd { "{} {} --tool_path=\"{}\" {}", scanner_tool_path, command, clang_scan_deps_path, extra_args };
 	REQUIRE(0 == run_cmd(tool_gen_cmd));
 }
 
@@ -103,8 +103,53 @@ set_property(TARGET test PROPERTY CXX_STANDARD 20)
 		run_ninja(ninja_path, false);
 		run_ninja(ninja_path, true);
 	}
+
+	SECTION("test static graph") {
+		test.create_files(R"(
+> main.cpp
+#include "h.h"
+import a;
+int main() {}
+> h.h
+int h();
+		)");
+		generate_compilation_database();
+
+		generate_ninja_from_compilation_database("", "gen_static");
+
+		run_ninja(ninja_path, false);
+		run_ninja(ninja_path, true);
+
+		// the headers are only in the regen edge's depfile, so removing one just regenerates build.ninja
+		std::ofstream { test.tmp_path / "main.cpp" } << "import a;\nint main() {}\n";
+		fs::remove(test.tmp_path / "h.h");
+		run_ninja(ninja_path, false);
+		run_ninja(ninja_path, true);
+	}
 #endif
 
+	SECTION("test static graph with clang") {
+		// the clang driver only writes the BMIs of the sources it knows to be module units
+		for (auto name : { "a", "b", "c", "d" }) {
+			fs::rename(test.tmp_path / fmt::format("{}.cpp", name), test.tmp_path / fmt::format("{}.cppm", name));
+			test.all_files_created.insert(fmt::format("{}.cppm", name));
+		}
+		std::ofstream { test.tmp_path / "CMakeLists.txt" } << R"(
+cmake_minimum_required(VERSION 3.15)
+project(test LANGUAGES CXX)
+set_source_files_properties(a.cppm b.cppm c.cppm d.cppm PROPERTIES LANGUAGE CXX)
+add_executable(test a.cppm b.cppm c.cppm d.cppm main.cpp)
+set_property(TARGET test PROPERTY CXX_STANDARD 20)
+)";
+		generate_compilation_database(Compiler::clang);
+
+		generate_ninja_from_compilation_database("--cmd_format=clang", "gen_static");
+
+		run_ninja(ninja_path, false);
+		run_ninja(ninja_path, true);
+		CHECK(fs::exists(build_dir / "pcm" / "test" / "a.pcm"));
+	}
+
 	SECTION("test ninja fork") {
 		auto compiler = GENERATE(ALL_COMPILERS);
 		generate_ninja(compiler);
@@ -1,3 +1,4 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
 #include "temp_file_test.h"
 #include "lmdb_wrapper.h"
@@ -7,10 +8,22 @@
 #include "test_config.h"
 #include "util.h"
 #include "trace.h"
+#include "scanner_db.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 namespace lmdb_test {
 
 ConfigPath scanner_output_file { "scanner_output_file", "" };
+ConfigString db_bench_sizes { "lmdb_bench_sizes", "10000,100000,1000000", "the number of items in each of the DBs used by [lmdb_benchmark]" };
 
 using namespace Catch::Matchers;
 
@@ -49,6 +62,61 @@ TEST_CASE("lmdb - multiple spans", "[lmdb]") {
 	txn.commit();
 }
 
+TEST_CASE("lmdb - get many", "[lmdb]") {
+	LMDB_Test test;
+	auto env = test.init_env();
+	auto txn = env.txn_read_write();
+	auto dbi = txn.open_db<uint32_t, uint32_t>("db");
+	for (uint32_t k = 10; k < 1000; k += 2)
+		dbi.put(k, k * 3);
+
+	// unsorted, with duplicates and with keys that are missing before, between and after the ones in the DB
+	std::vector<uint32_t> keys = { 500, 3, 10, 11, 998, 12, 500, 2000, 13, 14, 999, 400 };
+	auto values = dbi.get_many(keys);
+	REQUIRE(values.size() == keys.size());
+	for (std::size_t idx = 0; idx < keys.size(); ++idx) {
+		uint32_t k = keys[idx];
+		bool in_db = (k >= 10 && k < 1000 && k % 2 == 0);
+		CHECK(values[idx].has_value() == in_db);
+		if (in_db && values[idx])
+			CHECK(*values[idx] == k * 3);
+	}
+	CHECK(dbi.get_many({}).empty());
+	txn.commit();
+}
+
+TEST_CASE("lmdb - put many", "[lmdb]") {
+	LMDB_Test test;
+	auto env = test.init_env();
+	auto txn = env.txn_read_write();
+	using key_t = uint32_t;
+	struct value_t {
+		uint32_t dummy = 42;
+		tcb::span<uint32_t> a;
+	};
+	auto dbi = txn.open_db<key_t, value_t>("db");
+	std::vector<uint32_t> a = { 1, 2, 3 };
+	dbi.put(10, { 1, a });
+	dbi.put(20, { 2, a });
+
+	// overwrites, inserts before and between the existing keys, appends, and a repeated key
+	std::vector<key_t> keys = { 30, 5, 20, 15, 40, 30 };
+	std::vector<value_t> values = { { 30, {} }, { 5, a }, { 20, a }, { 15, {} }, { 40, a }, { 31, a } };
+	dbi.put_many(keys, [&](std::size_t idx) -> const value_t& {
+		return values[idx];
+	});
+
+	CHECK(dbi.size() == 6);
+	CHECK(dbi.get(5).dummy == 5);
+	CHECK(dbi.get(10).dummy == 1);
+	CHECK(dbi.get(15).a.empty());
+	CHECK(dbi.get(20).dummy == 20);
+	CHECK(dbi.get(30).dummy == 31);
+	CHECK(dbi.get(40).a.size() == 3);
+	CHECK(dbi.get(40).a[2] == 3);
+	txn.commit();
+}
+
 TEST_CASE("lmdb - string store", "[lmdb]") {
 	LMDB_Test test;
 	auto env = test.init_env();
@@ -127,6 +195,90 @@ TEST_CASE("lmdb - path store", "[lmdb]") {
 	// todo: change_dir("C:") check(id, "../x"); etc.
 }
 
+TEST_CASE("lmdb - path relativizer", "[lmdb]") {
+	TempFileTest test;
+
+	auto check = [&](mdb::path_relativizer& rel, const fs::path& path, std::string expected) {
+		INFO("path is " << path.string());
+		CHECK(rel.relative(path.string()) == expected);
+	};
+
+	mdb::path_relativizer rel { (test.tmp_path / "a/b").string() };
+	check(rel, test.tmp_path / "a/b/c.cpp", "c.cpp");
+	check(rel, test.tmp_path / "a/b/c/d.cpp", "c/d.cpp");
+	check(rel, test.tmp_path / "a/b/./c/../d.cpp", "d.cpp");
+	check(rel, test.tmp_path / "a/x.cpp", "../x.cpp");
+	check(rel, test.tmp_path / "a/bc/d.cpp", "../bc/d.cpp");
+	check(rel, test.tmp_path / "x/y.cpp", "../../x/y.cpp");
+	check(rel, test.tmp_path / "a/b", ".");
+	check(rel, test.tmp_path / "a/b/", ".");
+	check(rel, test.tmp_path / "a", "..");
+	check(rel, test.tmp_path / "a/b/Mixed/Case.cpp", "Mixed/Case.cpp");
+	check(rel, test.tmp_path / "a/Bc/D.cpp", "../Bc/D.cpp");
+#ifdef _WIN32
+	// only the prefix is case-insensitive
+	std::string upper_base = (test.tmp_path / "a/b").string();
+	std::transform(upper_base.begin(), upper_base.end(), upper_base.begin(), ::toupper);
+	check(rel, upper_base + "/Mixed.cpp", "Mixed.cpp");
+#endif
+
+	// the relative paths are relative to the current path
+	mdb::path_relativizer rel2 { "b", (test.tmp_path / "a").string() };
+	check(rel2, "c.cpp", "../c.cpp");
+	check(rel2, "b/c.cpp", "c.cpp");
+	check(rel2, "../x.cpp", "../../x.cpp");
+	check(rel2, test.tmp_path / "a/b/c.cpp", "c.cpp");
+}
+
+TEST_CASE("lmdb - scanner DB - torn DB recovery", "[lmdb]") {
+	LMDB_Test test;
+	test.all_files_created.insert("scanner.mdb");
+	test.all_files_created.insert("scanner.mdb-lock");
+	test.all_files_created.insert("scanner.mdb-users");
+	test.all_files_created.insert("scanner.mdb-writers");
+	vector_map<cppm::target_idx_t, std::string_view> targets = { "target" };
+	auto open = [&](cppm::DB& db) {
+		db.open(test.tmp_path_str, "scanner.mdb", cppm::Scanner::Durability::ASYNC);
+		db.read_write_transaction();
+	};
+	{
+		cppm::DB db;
+		open(db);
+		CHECK(!db.rebuilt);
+		db.get_target_ids(targets);
+		db.update_items({});
+		db.commit_transaction();
+	}
+	{
+		cppm::DB db;
+		open(db);
+		CHECK(!db.rebuilt); // the last commit is all there
+		// pretend that the last relaxed commit was lost
+		db.txn_rw.open_db<uint64_t, cppm::DB::db_epoch>("header").put(2, { db.txn_rw.id() - 2, true });
+		db.txn_rw.commit();
+	}
+	{
+		cppm::DB db;
+		open(db);
+		CHECK(db.rebuilt);
+		CHECK(db.get_target_ids(targets)[cppm::target_idx_t { 0 }] > db.target_store.db_max_id); // the target is new again
+		db.commit_transaction();
+	}
+	{
+		cppm::DB db;
+		open(db);
+		CHECK(!db.rebuilt);
+	}
+	// not an lmdb file at all
+	std::ofstream { test.tmp_path / "scanner.mdb", std::ios::binary | std::ios::trunc } << std::string(16 * 1024, 'x');
+	{
+		cppm::DB db;
+		open(db);
+		CHECK(db.rebuilt);
+		db.commit_transaction();
+	}
+}
+
 auto read_scanner_output() {
 	TRACE();
 	std::vector<std::string> ret;
@@ -358,4 +510,411 @@ TEST_CASE("lmdb - path store - benchmark", "[lmdb_path_store_benchmark]") {
 #endif
 }
 
+// the page faults of this process so far
+std::size_t get_page_faults() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PageFaultCount;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (std::size_t)(usage.ru_minflt + usage.ru_majflt);
+#endif
+}
+
+// a DB of the same shape as the scanner's, with nr_items items in a single target
+// each item depends on 30 of the shared headers, every 10th item on another item and
+// every 20th item exports a module, with each item importing 2 modules
+struct ItemDB_Test : public LMDB_Test
+{
+	static constexpr int nr_file_deps = 30;
+	std::size_t nr_items = 0;
+	std::vector<std::string> item_paths, header_paths, module_names;
+	vector_map<cppm::scan_item_idx_t, cppm::ScanItemView> items;
+	vector_map<cppm::target_idx_t, std::string_view> targets = { "bench" };
+	uint32_t rand_state = 42;
+
+	uint32_t next_rand() { // deterministic, so that the DBs are the same between runs
+		rand_state = rand_state * 1664525 + 1013904223;
+		return rand_state >> 8;
+	}
+
+	ItemDB_Test(std::size_t nr_items) : nr_items(nr_items) {
+		all_files_created.insert("scanner.mdb");
+		all_files_created.insert("scanner.mdb-lock");
+		all_files_created.insert("scanner.mdb-users");
+		all_files_created.insert("scanner.mdb-writers");
+		for (std::size_t i = 0; i < nr_items; ++i)
+			item_paths.push_back(fmt::format("src/dir_{}/file_{}.cpp", i % 100, i));
+		for (std::size_t i = 0; i < std::max<std::size_t>(100, nr_items / 10); ++i)
+			header_paths.push_back(fmt::format("include/lib_{}/header_{}.h", i % 50, i));
+		for (std::size_t i = 0; i < std::max<std::size_t>(10, nr_items / 50); ++i)
+			module_names.push_back(fmt::format("lib_{}.module_{}", i % 50, i));
+		for (auto& path : item_paths)
+			items.push_back({ path, cppm::cmd_idx_t { 0 }, cppm::target_idx_t { 0 } });
+	}
+
+	fs::path db_file() const {
+		return tmp_path / "scanner.mdb";
+	}
+
+	void open(cppm::DB& db) {
+		db.open(tmp_path_str, "scanner.mdb");
+		db.read_write_transaction();
+	}
+
+	auto get_item_data(cppm::DB& db) {
+		auto target_ids = db.get_target_ids(targets);
+		vector_map<cppm::scan_item_idx_t, cppm::db_target_id> item_target_ids;
+		item_target_ids.assign((std::size_t)items.size(), target_ids[cppm::target_idx_t { 0 }]);
+		auto data = db.get_item_data(item_target_ids, tmp_path_str, items);
+		return std::pair { std::move(data), std::move(item_target_ids) };
+	}
+
+	// new entries for every step'th item, with new deps on nr_new_headers headers that are not yet in the DB
+	cppm::DB::item_write_batch make_batch(cppm::DB& db, std::size_t step, std::size_t nr_new_headers = 0) {
+		auto [data, item_target_ids] = get_item_data(db);
+		db.init_stores();
+
+		std::vector<cppm::file_id_t> header_ids;
+		for (auto& path : header_paths)
+			header_ids.push_back(db.try_add_file(path));
+		std::size_t first_new_header = header_paths.size();
+		for (std::size_t i = 0; i < nr_new_headers; ++i)
+			header_paths.push_back(fmt::format("include/new/header_{}.h", first_new_header + i));
+		for (std::size_t i = first_new_header; i < header_paths.size(); ++i)
+			header_ids.push_back(db.try_add_file(header_paths[i]));
+		std::vector<cppm::module_id_t> module_ids;
+		for (auto& name : module_names)
+			module_ids.push_back(db.try_add_module(name));
+
+		cppm::DB::item_write_batch batch;
+		std::vector<cppm::file_id_t> file_deps(nr_file_deps);
+		for (std::size_t i = 0; i < nr_items; i += step) {
+			auto idx = cppm::scan_item_idx_t { i };
+			for (auto& dep : file_deps)
+				dep = header_ids[next_rand() % header_ids.size()];
+			if (nr_new_headers > 0)
+				file_deps.back() = header_ids[first_new_header + next_rand() % nr_new_headers];
+			cppm::item_id_t item_dep;
+			tcb::span<cppm::item_id_t> item_deps;
+			if (i % 10 == 1) {
+				item_dep = { data.file_id[cppm::scan_item_idx_t { i - 1 }], item_target_ids[idx] };
+				item_deps = { &item_dep, 1 };
+			}
+			cppm::module_id_t imports[2] = {
+				module_ids[next_rand() % module_ids.size()], module_ids[next_rand() % module_ids.size()]
+			};
+			cppm::DB::item_entry entry;
+			entry.cmd_hash = 1234;
+			entry.last_successful_scan = cppm::file_time_t_now();
+			entry.file_deps = file_deps;
+			entry.item_deps = item_deps;
+			entry.exports = (i % 20 == 0) ? module_ids[(i / 20) % module_ids.size()] : cppm::module_id_t {};
+			entry.imports = imports;
+			batch.add({ data.file_id[idx], item_target_ids[idx] }, entry);
+		}
+		return batch;
+	}
+
+	void update_items(cppm::DB& db, std::size_t step, std::size_t nr_new_headers = 0) {
+		db.update_items(make_batch(db, step, nr_new_headers));
+	}
+
+	struct measurement {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::size_t page_faults = get_page_faults();
+	};
+
+	void report(std::string_view what, const measurement& m) {
+		auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - m.start).count();
+		fmt::print("{} items - {}: {}ms, {} page faults, DB file size {} KB\n", nr_items, what,
+			elapsed_ms, get_page_faults() - m.page_faults, fs::file_size(db_file()) / 1024);
+	}
+};
+
+TEST_CASE("lmdb - scanner DB - map growth", "[lmdb]") {
+	ItemDB_Test test { 2000 };
+	{
+		cppm::DB db;
+		db.open(test.tmp_path_str, "scanner.mdb");
+		db.env.set_map_size(64 * 1024); // way too small for all the items
+		db.read_write_transaction();
+		auto batch = test.make_batch(db, 1);
+		db.write_and_commit([&] {
+			db.update_items(batch);
+		});
+		CHECK(db.map_growths > 0);
+	}
+	cppm::DB db;
+	test.open(db);
+	CHECK(db.map_growths == 0); // the initial size is at least the size of the file
+	auto [data, item_target_ids] = test.get_item_data(db);
+	for (auto& deps : data.file_deps)
+		CHECK(deps.size() == ItemDB_Test::nr_file_deps);
+}
+
+TEST_CASE("lmdb - scanner DB - map growth with another writer", "[lmdb]") {
+	ItemDB_Test test { 2000 };
+	std::thread other_writer;
+	{
+		cppm::DB db;
+		db.open(test.tmp_path_str, "scanner.mdb");
+		db.env.set_map_size(64 * 1024); // way too small for all the items
+		db.read_write_transaction();
+		auto batch = test.make_batch(db, 1);
+		// the other writer waits for the whole write transaction, even while it's restarted to grow the map
+		other_writer = std::thread([&] {
+			cppm::DB other_db;
+			other_db.open(test.tmp_path_str, "scanner.mdb");
+			other_db.read_write_transaction();
+			other_db.write_and_commit([] {});
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		db.write_and_commit([&] {
+			db.update_items(batch);
+		});
+		CHECK(db.map_growths > 0);
+	}
+	other_writer.join();
+	cppm::DB db;
+	test.open(db);
+	auto [data, item_target_ids] = test.get_item_data(db);
+	for (auto& deps : data.file_deps)
+		CHECK(deps.size() == ItemDB_Test::nr_file_deps);
+}
+
+TEST_CASE("lmdb - scanner DB - gc", "[lmdb]") {
+	ItemDB_Test test { 200 };
+	auto get_dep_paths = [&](cppm::DB& db) {
+		auto [data, item_target_ids] = test.get_item_data(db);
+		std::vector<std::vector<std::string>> dep_paths;
+		for (auto& deps : data.file_deps) {
+			dep_paths.emplace_back();
+			for (auto dep : deps)
+				dep_paths.back().push_back((std::string)db.path_store.get_file_path(dep));
+		}
+		return dep_paths;
+	};
+	{
+		cppm::DB db;
+		test.open(db);
+		test.update_items(db, 1);
+		db.commit_transaction();
+	}
+	std::vector<std::vector<std::string>> dep_paths_before;
+	std::vector<cppm::item_id_t> kept_item_ids;
+	{
+		// remove the second half of the items, nothing else uses their paths
+		cppm::DB db;
+		test.open(db);
+		dep_paths_before = get_dep_paths(db);
+		auto [data, item_target_ids] = test.get_item_data(db);
+		auto items_db = db.txn_rw.open_db<cppm::item_id_t, cppm::DB::item_entry>("items");
+		for (auto idx = cppm::scan_item_idx_t { 0 }; idx < cppm::scan_item_idx_t { 100 }; ++idx)
+			kept_item_ids.push_back({ data.file_id[idx], item_target_ids[idx] });
+		for (auto idx = cppm::scan_item_idx_t { 100 }; idx < test.items.size(); ++idx)
+			items_db.del({ data.file_id[idx], item_target_ids[idx] });
+		db.commit_transaction();
+	}
+	cppm::GcStats stats;
+	{
+		cppm::DB db;
+		db.open(test.tmp_path_str, "scanner.mdb");
+		db.read_write_transaction();
+		cppm::DB::gc_id_remap remap;
+		db.write_and_commit([&] {
+			remap = db.remove_unused_ids(stats);
+		});
+		db.compact();
+		for (auto& id : kept_item_ids)
+			id = remap.get(id);
+	}
+	CHECK(stats.items == 100);
+	CHECK(stats.paths_before - stats.paths_after >= 100);
+	CHECK(stats.targets_after == 1);
+
+	cppm::DB db;
+	test.open(db);
+	auto dep_paths_after = get_dep_paths(db);
+	for (std::size_t i = 0; i < 100; ++i)
+		CHECK(dep_paths_after[i] == dep_paths_before[i]);
+	for (std::size_t i = 100; i < 200; ++i)
+		CHECK(dep_paths_after[i].empty());
+	// the ids read before the gc are remapped to the new ones
+	auto [data, item_target_ids] = test.get_item_data(db);
+	for (std::size_t i = 0; i < 100; ++i) {
+		auto idx = cppm::scan_item_idx_t { i };
+		CHECK(kept_item_ids[i] == cppm::item_id_t { data.file_id[idx], item_target_ids[idx] });
+	}
+}
+
+TEST_CASE("lmdb - scanner DB - gc with relaxed durability", "[lmdb]") {
+	LMDB_Test test;
+	test.all_files_created.insert("scanner.mdb");
+	test.all_files_created.insert("scanner.mdb-lock");
+	test.all_files_created.insert("scanner.mdb-users");
+	test.all_files_created.insert("scanner.mdb-writers");
+	vector_map<cppm::target_idx_t, std::string_view> targets = { "target" };
+	auto open = [&](cppm::DB& db) {
+		db.open(test.tmp_path_str, "scanner.mdb", cppm::Scanner::Durability::ASYNC);
+		db.read_write_transaction();
+	};
+	{
+		cppm::DB db;
+		open(db);
+		db.get_target_ids(targets);
+		db.update_items({});
+		db.commit_transaction();
+	}
+	{
+		cppm::DB db;
+		open(db);
+		cppm::GcStats stats;
+		db.write_and_commit([&] {
+			db.remove_unused_ids(stats);
+		});
+		db.compact();
+	}
+	cppm::DB db;
+	open(db);
+	CHECK(!db.rebuilt); // the epoch written by the gc's commit must still be valid after compacting
+}
+
+TEST_CASE("lmdb - scanner DB - partitioned", "[lmdb]") {
+	ItemDB_Test test { 50 };
+	test.all_files_created.insert("scanner.items.1.mdb");
+	test.all_files_created.insert("scanner.items.1.mdb-lock");
+	test.all_files_created.insert("scanner.items.1.mdb-users");
+	test.all_files_created.insert("scanner.items.1.mdb-writers");
+	auto open = [&](cppm::DB& db) {
+		db.open_partitioned(test.tmp_path_str, test.targets);
+		db.read_write_transaction();
+	};
+	struct item_names {
+		std::vector<std::string> deps;
+		std::string exports;
+	};
+	std::vector<item_names> names_before;
+	{
+		cppm::DB db;
+		open(db);
+		auto batch = test.make_batch(db, 1);
+		for (auto& item : batch.staged) {
+			auto entry = mdb::impl::from_val<cppm::DB::item_entry>(MDB_val { item.size, batch.values.data() + item.ofs });
+			auto& names = names_before.emplace_back();
+			for (auto dep : entry.file_deps)
+				names.deps.push_back((std::string)db.path_store.get_file_path(dep));
+			names.exports = entry.exports.is_valid() ? db.get_module_name(entry.exports) : "";
+		}
+
+		// another scan adds a path and a module in the meantime, taking the ids that this scan used
+		db.shared_txn_ro = {};
+		db.shared.read_write_transaction();
+		mdb::path_id_store<cppm::file_id_t> other_paths { "paths" };
+		other_paths.read_paths(db.shared.txn_rw, "");
+		other_paths.try_add((test.tmp_path / "other.h").string());
+		mdb::string_id_store<cppm::module_id_t> other_modules { "modules" };
+		other_modules.init(db.shared.txn_rw, {});
+		other_modules.try_add("other");
+		db.shared.write_and_commit([&] {
+			other_paths.commit_changes(db.shared.txn_rw);
+			other_modules.commit_changes(db.shared.txn_rw);
+		});
+
+		auto remap = db.merge_shared_stores();
+		CHECK(remap.changed);
+		batch = cppm::DB::remap_items(batch, remap);
+		db.write_and_commit([&] {
+			db.update_items(batch);
+		});
+	}
+
+	cppm::DB db;
+	open(db);
+	auto [data, item_target_ids] = test.get_item_data(db);
+	db.init_stores();
+	REQUIRE(names_before.size() == (std::size_t)test.items.size());
+	for (auto idx : test.items.indices()) {
+		auto& names = names_before[(std::size_t)idx];
+		std::vector<std::string> deps;
+		for (auto dep : data.file_deps[idx])
+			deps.push_back((std::string)db.path_store.get_file_path(dep));
+		CHECK(deps == names.deps);
+		CHECK((data.exports[idx].is_valid() ? (std::string)db.get_module_name(data.exports[idx]) : "") == names.exports);
+	}
+	CHECK(db.get_module_name(cppm::module_id_t { 1 }) == "other");
+}
+
+TEST_CASE("lmdb - scanner DB - benchmark", "[lmdb_benchmark]") {
+	std::vector<std::size_t> sizes;
+	for (std::size_t pos = 0; pos < db_bench_sizes.size(); ) {
+		std::size_t end = std::min(db_bench_sizes.find(',', pos), db_bench_sizes.size());
+		sizes.push_back(std::stoull(db_bench_sizes.substr(pos, end - pos)));
+		pos = end + 1;
+	}
+
+	for (std::size_t nr_items : sizes) {
+		ItemDB_Test test { nr_items };
+		{
+			ItemDB_Test::measurement m;
+			cppm::DB db;
+			test.open(db);
+			test.update_items(db, 1);
+			db.commit_transaction();
+			test.report("initial fill", m);
+		}
+
+		{
+			ItemDB_Test::measurement m;
+			cppm::DB db;
+			test.open(db);
+			test.get_item_data(db);
+			test.report("reopen + get_item_data", m);
+		}
+
+		cppm::DB read_db;
+		test.open(read_db);
+		auto item_data = test.get_item_data(read_db);
+		auto& item_target_ids = item_data.second;
+		BENCHMARK(fmt::format("{} items - path_id_store::read_paths", nr_items)) {
+			read_db.path_store.read_paths(read_db.txn_rw, test.tmp_path_str);
+			return read_db.path_store.next_id;
+		};
+		BENCHMARK(fmt::format("{} items - string_id_store::init", nr_items)) {
+			mdb::string_id_store<cppm::module_id_t> module_store { "modules" };
+			module_store.init(read_db.txn_rw, {});
+			return module_store.next_id;
+		};
+		BENCHMARK(fmt::format("{} items - get_item_data", nr_items)) {
+			return read_db.get_item_data(item_target_ids, test.tmp_path_str, test.items).file_id.size();
+		};
+		read_db.close_env(); // abort, so that the DB can be reopened below
+
+		// every iteration reopens the DB and rewrites 1% of the items, with a few new paths
+		// so the DB file grows with the number of iterations
+		BENCHMARK(fmt::format("{} items - update 1% of the items", nr_items)) {
+			cppm::DB db;
+			test.open(db);
+			test.update_items(db, 100, 10);
+			db.commit_transaction();
+		};
+
+		{
+			ItemDB_Test::measurement m;
+			cppm::DB db;
+			test.open(db);
+			test.update_items(db, 100, 10);
+			test.report("update 1% of the items", m);
+			ItemDB_Test::measurement commit_m;
+			db.commit_transaction();
+			test.report("commit_transaction", commit_m);
+		}
+	}
+}
+
 } // namespace lmdb_test
\ No newline at end of file
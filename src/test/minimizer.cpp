@@ -0,0 +1,37 @@
+#include <catch2/catch.hpp>
+#include "minimizer.h"
+
+std::string minimize(std::string_view src) {
+	std::string out;
+	cppm::minimize_source(src, out);
+	return out;
+}
+
+TEST_CASE("minimize sources", "[minimizer]") {
+	SECTION("directives") {
+		CHECK(minimize("#pragma once\nint x;\n  #  include <a.h>\nvoid f() {}\n") ==
+			"#pragma once\n#  include <a.h>\n");
+		CHECK(minimize("#define F(x) \\\n\tx + 1\nint y;\n") == "#define F(x) \tx + 1\n");
+		CHECK(minimize("#if defined(A) && __has_include(<b//c.h>)\n#endif\n") ==
+			"#if defined(A) && __has_include(<b//c.h>)\n#endif\n");
+	}
+	SECTION("comments") {
+		CHECK(minimize("// #include <a.h>\n/* #include <b.h>\n */ #include <c.h> // d\n") ==
+			"#include <c.h> \n");
+		CHECK(minimize("#include \"a.h\" /* x */\n") == "#include \"a.h\"  \n");
+	}
+	SECTION("literals") {
+		CHECK(minimize("auto s = R\"d(\n#include <a.h>\n)d\";\n#include <b.h>\n") == "#include <b.h>\n");
+		CHECK(minimize("char c = '\"';\nint i = 1'000;\n#include <a.h>\n") == "#include <a.h>\n");
+		CHECK(minimize("const char* s = \"#include <a.h>\";\n") == "");
+		CHECK(minimize("#error don't\n") == "#error don't\n");
+	}
+	SECTION("modules") {
+		CHECK(minimize("export module a.b;\nimport c;\nexport import :d;\nimport <e.h>;\nexport int f();\n") ==
+			"export module a.b;\nimport c;\nexport import :d;\nimport <e.h>;\n");
+		CHECK(minimize("module;\n#include <a.h>\nmodule b;\n") == "module;\n#include <a.h>\nmodule b;\n");
+		CHECK(minimize("import a\n  .b;\nmodule = 3;\nimport(x);\n") == "import a   .b;\n");
+		CHECK(minimize("module::f();\nimport::g(1);\nexport import ::h;\nmodule :: x;\n") == "");
+		CHECK(minimize("module :private;\nimport:a;\n") == "module :private;\nimport:a;\n");
+	}
+}
@@ -0,0 +1,173 @@
+#include "module_cmdgen.h"
+#include <nlohmann/json.hpp>
+#include <fmt/core.h>
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#include "test_config.h"
+#include "temp_file_test.h"
+#include "cmd_line_utils.h"
+
+namespace module_refs_benchmark {
+
+ConfigString cfg_chain_length { "module_refs_bench_chain", "500", "the number of modules in the import chain" };
+ConfigPath cfg_clang_path { "module_refs_bench_clang", "", "if set, build the chain with this clang++ and time the compile startup of the last importer" };
+ConfigString cfg_repeat { "module_refs_bench_repeat", "3", "how many times to time the compile startup" };
+ConfigPath cfg_output { "module_refs_bench_output", "", "append the results here as JSON lines, instead of printing them" };
+
+using bench_clock = std::chrono::steady_clock;
+
+int64_t elapsed_us(bench_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - start).count();
+}
+
+// m_0 <- m_1 <- ... <- m_<n-1> <- main.cpp
+// i.e each module only imports the previous one, so without a prebuilt module path
+// the number of references grows quadratically with the length of the chain
+struct ModuleChain : public TempFileTest {
+	int length = 0;
+	fs::path src_dir, bmi_dir;
+	std::string bmi_dir_str;
+	std::vector<std::string> module_names, bmi_files;
+	cppm::ScanItemSet item_set;
+	cppm::ScanItemSetOwnedView item_set_owned_view;
+	cppm::ModuleVisitor info;
+
+	static std::string module_name(int i) {
+		return fmt::format("m_{}", i);
+	}
+
+	void write_file(const std::string& name, const std::string& contents) {
+		std::ofstream { src_dir / name, std::ios::binary } << contents;
+	}
+
+	ModuleChain(int length) : length(length) {
+		src_dir = create_dir("src");
+		bmi_dir = create_dir("bmi");
+		bmi_dir_str = bmi_dir.generic_string();
+
+		item_set.item_root_path = src_dir.string();
+		item_set.commands.push_back("clang++ -std=c++20");
+		item_set.targets.push_back("chain");
+
+		for (int i = 0; i < length; ++i) {
+			module_names.push_back(module_name(i));
+			bmi_files.push_back(cppm::ModuleCommandGenerator::prebuilt_bmi_file(bmi_dir_str, module_names.back()));
+			std::string contents = fmt::format("export module {};\n", module_name(i));
+			if (i > 0)
+				contents += fmt::format("import {};\nexport int f_{}() {{ return f_{}() + 1; }}\n", module_name(i - 1), i, i - 1);
+			else
+				contents += "export int f_0() { return 1; }\n";
+			std::string path = module_name(i) + ".cppm";
+			write_file(path, contents);
+			item_set.items.push_back({ std::move(path), cppm::cmd_idx_t { 0 }, cppm::target_idx_t { 0 } });
+		}
+		write_file("main.cpp", fmt::format("import {};\nint main() {{ return f_{}(); }}\n", module_name(length - 1), length - 1));
+		item_set.items.push_back({ "main.cpp", cppm::cmd_idx_t { 0 }, cppm::target_idx_t { 0 } });
+		item_set_owned_view = cppm::ScanItemSetOwnedView::from(item_set);
+
+		// the imports of item i (for i > 0) are at imports_item_buf[i - 1]
+		for (int i = 0; i < length; ++i)
+			info.imports_item_buf.push_back(cppm::scan_item_idx_t { (std::size_t)i });
+		auto* buf = info.imports_item_buf.data();
+		info.imports_item.push_back({});
+		info.exports.push_back(module_names[0]);
+		for (int i = 1; i <= length; ++i) {
+			info.imports_item.push_back({ buf + i - 1, 1 });
+			info.exports.push_back(i < length ? std::string_view { module_names[i] } : std::string_view {});
+		}
+		info.collate_success = true;
+	}
+
+	cppm::ModuleCommandGenerator make_generator(bool prebuilt) {
+		cppm::ModuleCommandGenerator gen { cppm::ScanItemSetView::from(item_set_owned_view), info };
+		if (prebuilt)
+			gen.clang_prebuilt_module_paths.push_back(bmi_dir_str);
+		return gen;
+	}
+
+	static auto format() {
+		return cppm::ModuleCommandGenerator::Format { cppm::ModuleCommandGenerator::Clang };
+	}
+
+	std::string_view get_bmi_file(cppm::scan_item_idx_t idx) const {
+		return bmi_files[(std::size_t)idx];
+	}
+
+	nlohmann::json generate(bool prebuilt) {
+		auto gen = make_generator(prebuilt);
+		auto start = bench_clock::now();
+		auto flags = gen.generate_all(format(), [&](cppm::scan_item_idx_t idx) { return get_bmi_file(idx); });
+		auto generate_time_us = elapsed_us(start);
+
+		std::size_t max_bytes = 0;
+		for (auto idx : item_set.items.indices())
+			max_bytes = std::max(max_bytes, flags[idx].size());
+		return {
+			{ "generate_time_us", generate_time_us },
+			{ "rsp_total_bytes", flags.arena.size() },
+			{ "rsp_max_bytes", max_bytes },
+		};
+	}
+
+	// builds the BMIs in the order of the chain and then times the compilation of main.cpp without codegen,
+	// which is mostly the time it takes clang to load the modules
+	void build_and_time(nlohmann::json& result, bool prebuilt, int nr_runs) {
+		auto gen = make_generator(prebuilt);
+		auto bmi_file_func = [&](cppm::scan_item_idx_t idx) { return get_bmi_file(idx); };
+		auto start = bench_clock::now();
+		for (int i = 0; i < length; ++i) {
+			auto idx = cppm::scan_item_idx_t { (std::size_t)i };
+			gen.generate(idx, format(), bmi_file_func);
+			cppm::CmdArgs cmd { "\"{}\" -std=c++20 --precompile \"{}\" -o \"{}\" {}", cfg_clang_path,
+				(src_dir / item_set.items[idx].path).string(), bmi_files[i], gen.references_to_string() };
+			REQUIRE(0 == run_cmd(cmd));
+		}
+		result["build_bmis_time_us"] = elapsed_us(start);
+
+		auto main_idx = cppm::scan_item_idx_t { (std::size_t)length };
+		gen.generate(main_idx, format(), bmi_file_func);
+		cppm::CmdArgs cmd { "\"{}\" -std=c++20 -fsyntax-only \"{}\" {}", cfg_clang_path,
+			(src_dir / "main.cpp").string(), gen.references_to_string() };
+		int64_t best_us = std::numeric_limits<int64_t>::max();
+		for (int run = 0; run < nr_runs; ++run) {
+			start = bench_clock::now();
+			REQUIRE(0 == run_cmd(cmd));
+			best_us = std::min(best_us, elapsed_us(start));
+		}
+		result["compile_startup_us"] = best_us;
+	}
+};
+
+void report(nlohmann::json result) {
+	result["benchmark"] = "module_refs";
+	std::string line = result.dump();
+	if (cfg_output.empty()) {
+		fmt::print("{}\n", line);
+	} else {
+		std::ofstream fout { cfg_output.str(), std::ios::app };
+		fout << line << '\n';
+	}
+}
+
+TEST_CASE("module references benchmark on a chain of modules", "[module_refs_benchmark]") {
+	int length = std::max(1, std::stoi(cfg_chain_length));
+	int nr_runs = std::max(1, std::stoi(cfg_repeat));
+	ModuleChain chain { length };
+
+	for (bool prebuilt : { false, true }) {
+		auto result = chain.generate(prebuilt);
+		result["mode"] = prebuilt ? "prebuilt_module_path" : "transitive_references";
+		result["chain_length"] = length;
+		if (!cfg_clang_path.empty())
+			chain.build_and_time(result, prebuilt, nr_runs);
+		report(std::move(result));
+	}
+}
+
+} // namespace module_refs_benchmark
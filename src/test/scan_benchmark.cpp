@@ -0,0 +1,253 @@
+#include "scanner.h"
+#include <nlohmann/json.hpp>
+#include <fmt/core.h>
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include "test_config.h"
+#include "temp_file_test.h"
+
+namespace scan_benchmark {
+
+ConfigPath clang_scan_deps_path { "clang_scan_deps_path", R"(c:\Program Files\cpp_modules\bin\clang-scan-deps.exe)" };
+ConfigString default_command { "scanner_default_command", R"("cl.exe" /c /Zi /nologo /W3 /WX- /diagnostics:column /Od /Ob0 /D WIN32 /D _WINDOWS /D _MBCS /EHsc /RTC1 /MDd /GS /fp:precise /Zc:wchar_t /Zc:forScope /Zc:inline /GR /std:c++latest /Gd /TP)" };
+
+ConfigString cfg_nr_tus { "scan_bench_tus", "1000", "the number of (non-module) translation units to generate" };
+ConfigString cfg_nr_headers { "scan_bench_headers", "200", "the number of headers shared between the translation units" };
+ConfigString cfg_header_fan_in { "scan_bench_header_fan_in", "10", "the number of headers included by each translation unit" };
+ConfigString cfg_module_depth { "scan_bench_module_depth", "5", "the number of layers in the module DAG" };
+ConfigString cfg_module_width { "scan_bench_module_width", "10", "the number of modules in each layer of the module DAG" };
+ConfigString cfg_header_unit_ratio { "scan_bench_header_unit_ratio", "0.1", "the fraction of the headers that are imported as header units" };
+ConfigString cfg_repeat { "scan_bench_repeat", "3", "how many times to run each of the incremental scenarios" };
+ConfigPath cfg_output { "scan_bench_output", "", "append the results here as JSON lines, instead of printing them" };
+
+struct ProjectParams {
+	int nr_tus = 0;
+	int nr_headers = 0;
+	int header_fan_in = 0;
+	int module_depth = 0;
+	int module_width = 0;
+	double header_unit_ratio = 0;
+
+	static ProjectParams from_config() {
+		ProjectParams p;
+		p.nr_tus = std::stoi(cfg_nr_tus);
+		p.nr_headers = std::max(1, std::stoi(cfg_nr_headers));
+		p.header_fan_in = std::min(p.nr_headers, std::stoi(cfg_header_fan_in));
+		p.module_depth = std::stoi(cfg_module_depth);
+		p.module_width = std::max(1, std::stoi(cfg_module_width));
+		p.header_unit_ratio = std::clamp(std::stod(cfg_header_unit_ratio), 0.0, 1.0);
+		return p;
+	}
+
+	int nr_header_units() const {
+		return (int)(header_unit_ratio * nr_headers);
+	}
+
+	nlohmann::json to_json() const {
+		return {
+			{ "tus", nr_tus },
+			{ "headers", nr_headers },
+			{ "header_fan_in", header_fan_in },
+			{ "module_depth", module_depth },
+			{ "module_width", module_width },
+			{ "header_units", nr_header_units() },
+		};
+	}
+};
+
+// generates a synthetic project in a temporary directory:
+// - headers h_<i>.h, the first nr_header_units of which are header units (imported) and the rest are #included
+// - a DAG of modules m_<layer>_<i>.cpp where each module imports two modules from the next layer
+// - translation units tu_<i>.cpp, each of which includes/imports header_fan_in headers and imports a module from the first layer
+struct SyntheticProject : public TempFileTest {
+	ProjectParams params;
+	fs::path src_dir, db_dir;
+	std::string db_dir_str;
+	cppm::ScanItemSet item_set;
+
+	static std::string header_name(int i) {
+		return fmt::format("h_{}.h", i);
+	}
+
+	static std::string module_name(int layer, int i) {
+		return fmt::format("m_{}_{}", layer, i);
+	}
+
+	void write_file(const std::string& name, const std::string& contents) {
+		std::ofstream { src_dir / name, std::ios::binary } << contents;
+	}
+
+	void add_item(std::string path, bool is_header_unit = false) {
+		item_set.items.push_back({ std::move(path), cppm::cmd_idx_t { 0 }, cppm::target_idx_t { 0 }, is_header_unit });
+	}
+
+	SyntheticProject(const ProjectParams& params) : params(params) {
+		src_dir = create_dir("src");
+		db_dir = create_dir("db");
+		db_dir_str = db_dir.string();
+
+		item_set.item_root_path = src_dir.string();
+		item_set.commands_contain_item_path = false;
+		item_set.commands.push_back(default_command.str());
+		item_set.targets.push_back("bench");
+
+		int nr_header_units = params.nr_header_units();
+		for (int i = 0; i < params.nr_headers; ++i) {
+			write_file(header_name(i), fmt::format(
+				"#pragma once\n"
+				"// header {}\n"
+				"inline int h_{}() {{ return {}; }}\n", i, i, i));
+			if (i < nr_header_units)
+				add_item(header_name(i), true);
+		}
+
+		for (int layer = 0; layer < params.module_depth; ++layer) {
+			for (int i = 0; i < params.module_width; ++i) {
+				std::string contents = fmt::format("export module {};\n", module_name(layer, i));
+				if (layer + 1 < params.module_depth) {
+					contents += fmt::format("import {};\n", module_name(layer + 1, i));
+					if (params.module_width > 1)
+						contents += fmt::format("import {};\n", module_name(layer + 1, (i + 1) % params.module_width));
+				}
+				contents += fmt::format("#include \"{}\"\n", header_name((layer * params.module_width + i) % params.nr_headers));
+				contents += fmt::format("export int {}() {{ return {}; }}\n", module_name(layer, i), i);
+				std::string path = module_name(layer, i) + ".cpp";
+				write_file(path, contents);
+				add_item(std::move(path));
+			}
+		}
+
+		// spread the includes so that each header has about the same number of includers
+		int stride = std::max(1, params.nr_headers / std::max(1, params.header_fan_in));
+		for (int i = 0; i < params.nr_tus; ++i) {
+			std::string contents;
+			if (params.module_depth > 0)
+				contents += fmt::format("import {};\n", module_name(0, i % params.module_width));
+			for (int k = 0; k < params.header_fan_in; ++k) {
+				int h = (i + k * stride) % params.nr_headers;
+				if (h < nr_header_units)
+					contents += fmt::format("import \"{}\";\n", header_name(h));
+				else
+					contents += fmt::format("#include \"{}\"\n", header_name(h));
+			}
+			contents += fmt::format("int tu_{}() {{ return {}; }}\n", i, i);
+			std::string path = fmt::format("tu_{}.cpp", i);
+			write_file(path, contents);
+			add_item(std::move(path));
+		}
+	}
+
+	// a header that's #included rather than imported, so touching it only invalidates its includers
+	std::string leaf_header() const {
+		return header_name(std::min(params.nr_header_units(), params.nr_headers - 1));
+	}
+
+	// the module interface in the last layer has the most transitive importers
+	std::string deepest_module_interface() const {
+		return module_name(params.module_depth - 1, 0) + ".cpp";
+	}
+
+	void touch_src(const std::string& name) {
+		fs::last_write_time(src_dir / name, fs::file_time_type::clock::now());
+	}
+
+	nlohmann::json scan(std::string_view scenario) {
+		auto item_set_owned_view = cppm::ScanItemSetOwnedView::from(item_set);
+		auto item_set_view = cppm::ScanItemSetView::from(item_set_owned_view);
+
+		cppm::DepInfoObserver observer; // only to have the results submitted, like the build system generators do
+		cppm::ModuleVisitor collated_results;
+		cppm::ScanStats stats;
+
+		cppm::Scanner::ConfigView config;
+		config.tool_type = cppm::Scanner::Type::CLANG_SCAN_DEPS;
+		config.tool_path = clang_scan_deps_path;
+		config.db_path = db_dir_str;
+		config.int_dir = config.db_path;
+		config.item_set = item_set_view;
+		config.concurrent_targets = false;
+		config.file_tracker_running = false;
+		config.observer = &observer;
+		config.submit_previous_results = true;
+		config.collated_results = &collated_results;
+		config.stats = &stats;
+
+		cppm::Scanner scanner;
+		auto start = std::chrono::steady_clock::now();
+		auto results = scanner.scan(config);
+		auto wall_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		std::size_t nr_failed = 0;
+		for (auto& res : results)
+			if (res.scan == cppm::scan_state::failed)
+				nr_failed++;
+		CHECK(nr_failed == 0);
+		CHECK(collated_results.collate_success);
+
+		std::size_t nr_ood = stats.items_by_ood_state[(std::size_t)cppm::ood_state::unknown];
+		for (auto state = (std::size_t)cppm::ood_state::command_changed; state < (std::size_t)cppm::ood_state::up_to_date; ++state)
+			nr_ood += stats.items_by_ood_state[state];
+
+		return {
+			{ "scenario", scenario },
+			{ "wall_time_us", wall_time_us },
+			{ "items", (std::size_t)results.size() },
+			{ "items_out_of_date", nr_ood },
+			{ "items_failed", nr_failed },
+			{ "files_stated", stats.files_stated },
+			{ "stat_time_us", stats.stat_time_us },
+			{ "scanner_wall_time_us", stats.scanner_wall_time_us },
+			{ "tool_output_bytes_parsed", stats.tool_output_bytes_parsed },
+			{ "db_pages_upper_bound", stats.db_pages_upper_bound },
+			{ "db_pages_written", stats.db_pages_written },
+			{ "new_paths", stats.new_paths },
+			{ "new_modules", stats.new_modules },
+			{ "db_map_growths", stats.db_map_growths },
+		};
+	}
+};
+
+void report(const ProjectParams& params, nlohmann::json result, int run) {
+	result["benchmark"] = "scan";
+	result["run"] = run;
+	result["project"] = params.to_json();
+	std::string line = result.dump();
+	if (cfg_output.empty()) {
+		fmt::print("{}\n", line);
+	} else {
+		std::ofstream fout { cfg_output.str(), std::ios::app };
+		fout << line << '\n';
+	}
+}
+
+TEST_CASE("scan benchmark on a synthetic project", "[scan_benchmark]") {
+	auto params = ProjectParams::from_config();
+	SyntheticProject project { params };
+	int nr_runs = std::max(1, std::stoi(cfg_repeat));
+
+	// the DB starts out empty, so there's a single cold run
+	report(params, project.scan("cold"), 0);
+
+	for (int run = 0; run < nr_runs; ++run)
+		report(params, project.scan("warm_noop"), run);
+
+	for (int run = 0; run < nr_runs; ++run) {
+		project.touch_src(project.leaf_header());
+		report(params, project.scan("touch_leaf_header"), run);
+	}
+
+	if (params.module_depth > 0) {
+		for (int run = 0; run < nr_runs; ++run) {
+			project.touch_src(project.deepest_module_interface());
+			report(params, project.scan("touch_module_interface"), run);
+		}
+	}
+}
+
+} // namespace scan_benchmark
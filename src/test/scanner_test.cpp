@@ -5,6 +5,7 @@
 #include <fmt/core.h>
 #include <catch2/catch.hpp>
 #include "util.h"
+#include "critical_path.h"
 
 #include <filesystem>
 
@@ -186,6 +187,7 @@ private:
 
 	vector_map<cppm::scan_item_idx_t, cppm::Scanner::Result> scanner_results;
 	std::unique_ptr<cppm::ModuleVisitor> collated_results;
+	cppm::ScanStats scan_stats;
 	
 	vector_map< cppm::scan_item_idx_t, char> expect_results;
 	vector_map<cppm::scan_item_idx_t, depinfo::DepInfo> all_expected;
@@ -195,6 +197,7 @@ private:
 	int current_line = 0; // line from which the last test method was called
 public:
 	bool submit_previous_results = false;
+	bool cache_minimized_sources = false;
 
 	void set_expected(depinfo::DepFormat expected, std::vector<std::vector<cppm::scan_item_idx_t>> expected_module_imports = {}) {
 		init_optionals(expected);
@@ -210,6 +213,8 @@ public:
 	TempFileScanTest() : TempFileTest() {
 		all_files_created.insert("scanner.mdb"); // todo: pass the names to scanner
 		all_files_created.insert("scanner.mdb-lock");
+		all_files_created.insert("scanner.mdb-users");
+		all_files_created.insert("scanner.mdb-writers");
 		all_files_created.insert("pp_commands.json");
 		item_set.item_root_path = tmp_path_str;
 		item_set.commands_contain_item_path = false; // todo: test when this is true
@@ -248,6 +253,18 @@ public:
 			add_item(file, target_idx);
 	}
 
+	// the scanner only sees the minimized copies of the unchanged files through the VFS overlay,
+	// so this appends to the ones that contain the marker without touching the original files
+	void append_to_minimized(std::string_view marker, std::string_view text) {
+		for (auto& entry : fs::directory_iterator(tmp_path / "minimized")) {
+			std::ifstream fin(entry.path(), std::ios::binary);
+			std::string contents { std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>() };
+			fin.close();
+			if (contents.find(marker) != std::string::npos)
+				std::ofstream(entry.path(), std::ios::binary | std::ios::app) << text;
+		}
+	}
+
 	void set_command_suffix(cppm::scan_item_idx_t idx, std::string_view suffix) {
 		// by construction, cmd idx == item idx
 		std::string& cmd = item_set.commands[id_cast<cppm::cmd_idx_t>(idx)];
@@ -276,8 +293,15 @@ public:
 		config.file_tracker_running = false;
 		config.observer = &collector;
 		config.submit_previous_results = submit_previous_results;
+		config.cache_minimized_sources = cache_minimized_sources;
+		if (cache_minimized_sources) {
+			all_files_created.insert("minimized_overlay.yaml");
+			all_dirs_created.insert("minimized");
+		}
 		if(submit_previous_results)
 			config.collated_results = collated_results.get();
+		scan_stats = {};
+		config.stats = &scan_stats;
 
 		cppm::Scanner scanner;
 
@@ -375,6 +399,13 @@ public:
 		auto expect_is_ood = to_id_map(ood_indices);
 		auto expect_failed = to_id_map(fail_indices);
 
+		// the stats should agree with the results
+		std::array<std::size_t, (std::size_t)cppm::ood_state::up_to_date + 1> exp_items_by_ood_state = {};
+		for (auto& res : scanner_results)
+			exp_items_by_ood_state[(std::size_t)res.ood]++;
+		CHECK(scan_stats.items_by_ood_state == exp_items_by_ood_state);
+		CHECK((scan_stats.scanner_wall_time_us > 0 || scan_stats.tool_output_bytes_parsed == 0));
+
 		auto expect_result = [&](cppm::scan_item_idx_t idx) {
 			if (expect_failed[idx])
 				return false;
@@ -527,6 +558,32 @@ TEST_CASE("scanner", "[scanner]") {
 	}
 }
 
+TEST_CASE("scanner - cached minimized sources", "[scanner]") {
+	TempFileScanTest test_;
+	test.cache_minimized_sources = true;
+
+	test.create_deps(R"(
+> a.h
+#define A_H
+> b.h
+	)");
+	test.create_items("target1", R"(
+> a.cpp
+#include "a.h"
+	)");
+
+	cppm::scan_item_idx_t a { 0 };
+
+	test.set_expected({ .sources = { { .input = "a.cpp", .depends = vdb{ "a.h" } } } });
+	test.scan_check({ a }); // first scan, a.h gets minimized
+
+	// a.h didn't change so its minimized copy should be used from the overlay
+	test.append_to_minimized("A_H", "#include \"b.h\"\n");
+	test.touch("a.cpp");
+	test.set_expected({ .sources = { { .input = "a.cpp", .depends = vdb{ "a.h", "b.h" } } } });
+	test.scan_check({ a });
+}
+
 TEST_CASE("scanner - modules", "[scanner]") {
 	TempFileScanTest test_;
 
@@ -813,6 +870,29 @@ import a;
 	}
 }
 
+TEST_CASE("scanner - critical paths", "[scanner]") {
+	using cppm::scan_item_idx_t;
+	// c <- b <- a <- tu1, c <- tu2
+	scan_item_idx_t c { 0 }, b { 1 }, a { 2 }, tu1 { 3 }, tu2 { 4 };
+	cppm::CollatedModuleInfo info;
+	info.imports_item_buf = { c, b, a, c };
+	auto* buf = info.imports_item_buf.data();
+	info.imports_item = { {}, { buf, 1 }, { buf + 1, 1 }, { buf + 2, 1 }, { buf + 3, 1 } };
+
+	SECTION("unit costs") {
+		auto paths = cppm::compute_critical_paths(info);
+		CHECK(paths.longest_chain == vector_map<scan_item_idx_t, uint64_t> { 4, 3, 2, 1, 1 });
+		CHECK(paths.downstream_weight == vector_map<scan_item_idx_t, uint64_t> { 5, 3, 2, 1, 1 });
+	}
+
+	SECTION("weighted") {
+		vector_map<scan_item_idx_t, uint64_t> costs = { 10, 1, 1, 1, 100 };
+		auto paths = cppm::compute_critical_paths(info, costs);
+		CHECK(paths.longest_chain == vector_map<scan_item_idx_t, uint64_t> { 110, 3, 2, 1, 100 });
+		CHECK(paths.downstream_weight == vector_map<scan_item_idx_t, uint64_t> { 113, 3, 2, 1, 100 });
+	}
+}
+
 // todo: test item_root_dir
 
 } // namespace scanner_test
\ No newline at end of file
@@ -35,7 +35,7 @@ void full_clean_one(const std::string& test)
 	for (auto dir : { "Debug", "intermediate", "Win32", "x64", "CMakeFiles" })
 		fs::remove_all(build_path / dir);
 	for (auto file : { "CMakeCache.txt", "build.ninja", ".ninja_log", ".ninja_deps",
-		"scanner.mdb", "scanner.mdb-lock" })
+		"scanner.mdb", "scanner.mdb-lock", "scanner.mdb-users", "scanner.mdb-writers" })
 		fs::remove(build_path / file);
 }
 
@@ -7,6 +7,7 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <cstdio>
 
 #include <fmt/core.h>
 #include <fmt/color.h>
@@ -17,6 +18,8 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <shellapi.h>
+#include <fcntl.h>
+#include <io.h>
 #else
 #include <unistd.h>
 #endif
@@ -234,6 +237,47 @@ int64_t run_cmd(const CmdArgs& args) {
 	return ret;
 }
 
+int64_t run_cmd_passthrough(const CmdArgs& args) {
+	reproc_t process;
+	auto argv = to_argv(args);
+
+	REPROC_ERROR err = REPROC_SUCCESS;
+	err = reproc_start(&process, &argv[0], nullptr, nullptr);
+	if (err != REPROC_SUCCESS)
+		return -1;
+
+#ifdef _WIN32
+	// otherwise the \n-s would become \r\n-s
+	_setmode(_fileno(stdout), _O_BINARY);
+	_setmode(_fileno(stderr), _O_BINARY);
+#endif
+
+	auto copy_loop = [&process](REPROC_STREAM stream, FILE* out) {
+		constexpr std::size_t read_buf_size = 32 * 1024;
+		std::vector<uint8_t> buf;
+		buf.resize(read_buf_size);
+		while (true) {
+			unsigned int bytes_read = 0;
+			REPROC_ERROR err = reproc_read(&process, stream, &buf[0], buf.size(), &bytes_read);
+			if (err != REPROC_SUCCESS)
+				break;
+			std::fwrite(buf.data(), 1, bytes_read, out);
+			std::fflush(out);
+		}
+	};
+
+	std::thread error_thread(copy_loop, REPROC_STREAM_ERR, stderr);
+	copy_loop(REPROC_STREAM_OUT, stdout);
+	error_thread.join();
+
+	err = reproc_wait(&process, REPROC_INFINITE);
+	int64_t ret = -1;
+	if (err == REPROC_SUCCESS)
+		ret = reproc_exit_status(&process);
+	reproc_destroy(&process);
+	return ret;
+}
+
 int64_t run_cmd_read_lines(const CmdArgs& args,
 	const std::function<bool(std::string_view)>& stdout_callback,
 	const std::function<bool(std::string_view)>& stderr_callback)
@@ -90,6 +90,9 @@ struct CmdArgs {
 
 int64_t run_cmd(const CmdArgs& args);
 
+// unlike run_cmd this writes the output of the command to stdout/stderr as is, e.g for ninja to parse
+int64_t run_cmd_passthrough(const CmdArgs& args);
+
 int64_t run_cmd_read_lines(const CmdArgs& args,
 	const std::function<bool(std::string_view)>& stdout_callback,
 	const std::function<bool(std::string_view)>& stderr_callback);